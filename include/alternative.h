@@ -0,0 +1,79 @@
+#ifndef SARRUS_ALTERNATIVE_H
+#define SARRUS_ALTERNATIVE_H
+
+#include <stdint.h>
+
+/*
+ * Boot-time instruction patching
+ *
+ * ALTERNATIVE(old, new, feature) emits `old` inline, padded with NOPs to the
+ * length of `new`, and records the site in .altinstructions. `new` itself is
+ * assembled out of line in .altinstr_replacement. alternatives_apply() copies
+ * `new` over the site when cpu_has(feature) is true, so the hot path pays no
+ * dispatch cost at all.
+ *
+ * ALTERNATIVE_2 takes two replacements; entries are applied in order, so
+ * the second one wins when both features are present.
+ *
+ * Replacements must be position independent, except that a leading
+ * call/jmp rel32 is relocated to the site.
+ */
+
+typedef struct alt_instr {
+    uint32_t site;              /* Original instruction */
+    uint32_t replacement;       /* Out-of-line replacement */
+    uint32_t feature;           /* CPU_FEATURE_* bit selecting the replacement */
+    uint8_t site_len;           /* Original instruction plus padding */
+    uint8_t replacement_len;
+    uint16_t reserved;
+} __attribute__((packed)) alt_instr_t;
+
+#define ALT_STRINGIFY_(x) #x
+#define ALT_STRINGIFY(x) ALT_STRINGIFY_(x)
+
+#define ALT_RLEN(n) "(6651" #n "f-6641" #n "f)"
+
+/* Pad the site (661b..) to at least the length of replacement n */
+#define ALT_PAD(n) \
+    ".skip -((" ALT_RLEN(n) "-(.-661b)) > 0) * (" ALT_RLEN(n) "-(.-661b)), 0x90\n"
+
+#define ALT_ENTRY(n, feature) \
+    " .long 661b\n" \
+    " .long 6641" #n "f\n" \
+    " .long " ALT_STRINGIFY(feature) "\n" \
+    " .byte 663b-661b\n" \
+    " .byte " ALT_RLEN(n) "\n" \
+    " .short 0\n"
+
+#define ALT_REPLACEMENT(n, newinstr) \
+    "6641" #n ":\n\t" newinstr "\n6651" #n ":\n"
+
+#define ALTERNATIVE(oldinstr, newinstr, feature) \
+    "661:\n\t" oldinstr "\n" \
+    ALT_PAD(1) \
+    "663:\n" \
+    ".pushsection .altinstructions, \"a\"\n" \
+    ALT_ENTRY(1, feature) \
+    ".popsection\n" \
+    ".pushsection .altinstr_replacement, \"ax\"\n" \
+    ALT_REPLACEMENT(1, newinstr) \
+    ".popsection\n"
+
+#define ALTERNATIVE_2(oldinstr, newinstr1, feature1, newinstr2, feature2) \
+    "661:\n\t" oldinstr "\n" \
+    ALT_PAD(1) \
+    ALT_PAD(2) \
+    "663:\n" \
+    ".pushsection .altinstructions, \"a\"\n" \
+    ALT_ENTRY(1, feature1) \
+    ALT_ENTRY(2, feature2) \
+    ".popsection\n" \
+    ".pushsection .altinstr_replacement, \"ax\"\n" \
+    ALT_REPLACEMENT(1, newinstr1) \
+    ALT_REPLACEMENT(2, newinstr2) \
+    ".popsection\n"
+
+/* Patch every site whose feature is present; call once after cpu_init() */
+void alternatives_apply(void);
+
+#endif /* SARRUS_ALTERNATIVE_H */
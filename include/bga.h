@@ -0,0 +1,44 @@
+#ifndef SARRUS_BGA_H
+#define SARRUS_BGA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bochs Graphics Adapter (QEMU -vga std, Bochs, VirtualBox) */
+#define BGA_PCI_VENDOR   0x1234
+#define BGA_PCI_DEVICE   0x1111
+#define BGA_DEFAULT_LFB  0xE0000000  /* Bochs default when there is no PCI BAR */
+#define BGA_MAX_WIDTH    1600
+#define BGA_MAX_HEIGHT   1200
+
+typedef struct bga_mode {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bpp;
+    uint32_t pitch;         /* Bytes per line */
+    uint32_t buffers;       /* Pages in the virtual screen: 2 when flipping works */
+    uint32_t front;         /* Page being scanned out */
+    uint8_t *lfb;           /* Page 0; page n starts n * height lines below */
+} bga_mode_t;
+
+/* Probe the adapter and find its linear framebuffer; ERROR_IO if absent */
+int bga_init(void);
+int bga_present(void);
+
+/* Switch to a linear framebuffer mode with two pages if video memory allows.
+ * bpp is 8, 15, 16, 24 or 32. Returns SUCCESS or ERROR_INVALID. */
+int bga_set_mode(uint32_t width, uint32_t height, uint32_t bpp);
+
+/* Back to VGA text mode */
+void bga_disable(void);
+
+const bga_mode_t *bga_current_mode(void);
+
+/* Page being drawn; the same as the front page in single-buffered modes */
+uint8_t *bga_back_buffer(void);
+uint8_t *bga_front_buffer(void);
+
+/* Show the back page by moving the display's Y offset; nothing is copied */
+void bga_flip(void);
+
+#endif /* SARRUS_BGA_H */
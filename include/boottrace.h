@@ -0,0 +1,17 @@
+#ifndef SARRUS_BOOTTRACE_H
+#define SARRUS_BOOTTRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BOOT_TRACE_MAX  32      /* Phases recorded; later marks are ignored */
+
+/* Start the named boot phase now, ending the previous one. The name must
+ * be a string literal without spaces; it is printed as a key. */
+void boot_trace(const char *phase);
+
+/* End the last phase and print the timeline: a table on the console, and
+ * "BOOTTRACE key=value ..." lines on serial for regression tracking */
+void boot_trace_report(void);
+
+#endif /* SARRUS_BOOTTRACE_H */
@@ -0,0 +1,115 @@
+#ifndef SARRUS_CPU_H
+#define SARRUS_CPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "alternative.h"
+
+/* CPU feature bits, filled in once by cpu_init() */
+#define CPU_FEATURE_CPUID   0x00000001
+#define CPU_FEATURE_FPU     0x00000002
+#define CPU_FEATURE_TSC     0x00000004
+#define CPU_FEATURE_CX8     0x00000008
+#define CPU_FEATURE_PAT     0x00000010
+#define CPU_FEATURE_FXSR    0x00000020
+#define CPU_FEATURE_SSE     0x00000040
+#define CPU_FEATURE_SSE2    0x00000080
+#define CPU_FEATURE_SSE3    0x00000100
+#define CPU_FEATURE_MWAIT   0x00000200
+#define CPU_FEATURE_ERMS    0x00000400  /* Enhanced REP MOVSB/STOSB */
+#define CPU_FEATURE_FSRM    0x00000800  /* Fast short REP MOVSB */
+#define CPU_FEATURE_INVLPG  0x00001000  /* 486+ */
+#define CPU_FEATURE_CLFLUSH 0x00002000
+
+/* Control register bits */
+#define CR0_MP  0x00000002
+#define CR0_EM  0x00000004
+#define CR0_TS  0x00000008
+#define CR0_NE  0x00000020
+#define CR0_PG  0x80000000
+#define CR4_OSFXSR     0x00000200
+#define CR4_OSXMMEXCPT 0x00000400
+
+/* Model-specific registers */
+#define MSR_IA32_PAT   0x00000277
+
+/* PAT memory types */
+#define PAT_UC         0x00
+#define PAT_WC         0x01
+#define PAT_WT         0x04
+#define PAT_WP         0x05
+#define PAT_WB         0x06
+#define PAT_UC_MINUS   0x07
+
+extern uint32_t cpu_features;
+extern char cpu_vendor[13];
+extern uint32_t cpu_tsc_khz;   /* TSC ticks per millisecond; 0 until calibrated */
+
+void cpu_init(void);
+void cpu_print_info(void);
+
+/* For code that runs before cpu_init() */
+int cpuid_supported(void);
+
+static inline int cpu_has(uint32_t feature) {
+    return (cpu_features & feature) == feature;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile ("cpuid"
+                      : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                      : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                      "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+/* Invalidate one TLB entry; patched to invlpg, 386s reload CR3 instead */
+static inline void flush_tlb_single(uint32_t addr) {
+    uint32_t scratch;
+    __asm__ volatile (ALTERNATIVE("movl %%cr3, %0\n\tmovl %0, %%cr3",
+                                  "invlpg (%1)", CPU_FEATURE_INVLPG)
+                      : "=&r"(scratch) : "r"(addr) : "memory");
+}
+
+/* Program the PAT so PWT selects write-combining (called by cpu_init()).
+ * Returns whether the kernel's PAT layout is active. */
+int pat_init(void);
+int pat_enabled(void);
+
+/* Halt until the next interrupt; mwait where available */
+void cpu_idle(void);
+
+/* Memory primitive variant patched in by alternatives_apply() (libc/memcpy.c) */
+const char *memops_variant(void);
+
+#endif /* SARRUS_CPU_H */
@@ -0,0 +1,32 @@
+#ifndef SARRUS_FBCON_H
+#define SARRUS_FBCON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FBCON_GLYPH_WIDTH   8
+#define FBCON_GLYPH_HEIGHT  16
+#define FBCON_COLUMNS       80      /* The terminal's cell grid */
+#define FBCON_ROWS          25
+#define FBCON_PAIR_CACHE    8       /* Colour pairs with expanded glyph rows */
+
+/* Capture the 8x16 font: from VGA plane 2 while the adapter is still in
+ * text mode, else from the video BIOS */
+int fbcon_init(void);
+
+/* Render the terminal onto a 32-bit linear framebuffer from now on. The
+ * 80x25 cell grid is centred; 640x400 fills the screen exactly. */
+int fbcon_attach(void *framebuffer, uint32_t width, uint32_t height, uint32_t pitch,
+                 uint32_t bpp);
+void fbcon_detach(void);
+int fbcon_active(void);
+
+/* Drawing primitives for terminal_flush(); bracket them with begin/end,
+ * which also pushes the changed pixels to the framebuffer */
+void fbcon_begin(void);
+void fbcon_end(void);
+void fbcon_draw_line(uint32_t row, const uint16_t *cells);
+void fbcon_draw_cursor(uint32_t row, uint32_t col, uint8_t attr, uint8_t start, uint8_t end);
+void fbcon_scroll(uint32_t lines);
+
+#endif /* SARRUS_FBCON_H */
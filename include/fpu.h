@@ -0,0 +1,37 @@
+#ifndef SARRUS_FPU_H
+#define SARRUS_FPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * FPU/SSE state management
+ *
+ * State is switched lazily: fpu_switch() only sets CR0.TS, and the first
+ * FPU/SSE instruction of the incoming thread traps (#NM) and loads its
+ * state. Threads that never touch the FPU never pay for fxsave/fxrstor.
+ *
+ * Kernel code may only use x87/SSE registers between kernel_fpu_begin()
+ * and kernel_fpu_end(), and must check kernel_fpu_usable() first when it
+ * can run from an interrupt handler.
+ */
+
+#define FPU_DEFAULT_MXCSR 0x1F80  /* All SIMD exceptions masked */
+
+typedef struct fpu_state {
+    uint8_t fxsave[512] __attribute__((aligned(16)));
+    int initialized;              /* fxsave area holds valid state */
+} fpu_state_t;
+
+void fpu_init(void);
+int fpu_enabled(void);
+
+/* Scheduler hook: `next` is the state of the thread about to run */
+void fpu_switch(fpu_state_t *next);
+
+/* Kernel SIMD sections (not nestable across interrupts, see above) */
+int kernel_fpu_usable(void);
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+#endif /* SARRUS_FPU_H */
@@ -0,0 +1,72 @@
+#ifndef SARRUS_GFX_H
+#define SARRUS_GFX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GFX_MAX_DAMAGE    16    /* Rectangles tracked per frame before merging harder */
+#define GFX_MERGE_SLACK   4096  /* Extra pixels a merge may cover that were not damaged */
+
+typedef struct gfx_rect {
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+} gfx_rect_t;
+
+/* A 2D pixel buffer in caller-provided memory, with the damage since the
+ * last present */
+typedef struct gfx_surface {
+    uint8_t *pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;                 /* Bytes per line */
+    uint32_t bpp;                   /* 8, 16 or 32 */
+    uint32_t damage_count;
+    gfx_rect_t damage[GFX_MAX_DAMAGE];
+    uint32_t prev_count;            /* Damage presented last frame */
+    gfx_rect_t prev[GFX_MAX_DAMAGE];
+    const struct gfx_surface *last_target;
+    uint32_t palette_version;       /* Palette the last scaled present used */
+} gfx_surface_t;
+
+/* 8-bit colour index to 0x00RRGGBB */
+typedef struct gfx_palette {
+    uint32_t lut[256];
+    uint32_t version;               /* Bumped by every change */
+} gfx_palette_t;
+
+void gfx_surface_init(gfx_surface_t *surface, void *pixels, uint32_t width, uint32_t height,
+                      uint32_t pitch, uint32_t bpp);
+
+/* Record a changed area; clipped to the surface and merged with overlapping
+ * or nearby rectangles */
+void gfx_damage(gfx_surface_t *surface, int32_t x, int32_t y, int32_t w, int32_t h);
+void gfx_damage_all(gfx_surface_t *surface);
+
+/* Drawing helpers; each records its own damage */
+void gfx_fill_rect(gfx_surface_t *surface, int32_t x, int32_t y, int32_t w, int32_t h,
+                   uint32_t color);
+void gfx_copy_rect(gfx_surface_t *surface, int32_t dx, int32_t dy,
+                   int32_t sx, int32_t sy, int32_t w, int32_t h);
+
+/* Copy the damaged areas of src to dst (same size and format), then start a
+ * new frame. When dst differs from the previous target, as with two flipped
+ * pages, last frame's damage is copied too so that page catches up. */
+void gfx_present(gfx_surface_t *src, gfx_surface_t *dst);
+
+/* The rectangles gfx_present would copy, clipped to dst, for targets that
+ * are not plain memory; also starts a new frame. list holds GFX_MAX_DAMAGE
+ * entries. Returns the count. */
+uint32_t gfx_take_damage(gfx_surface_t *src, const gfx_surface_t *dst, gfx_rect_t *list);
+
+/* Set count entries from first, from 8-bit R, G, B triplets (DOOM's PLAYPAL
+ * layout). Only the lookup is rebuilt; the next present redraws everything. */
+void gfx_palette_set(gfx_palette_t *palette, const uint8_t *rgb, uint32_t first, uint32_t count);
+
+/* Same as gfx_present, for an 8-bit surface shown through a palette on a
+ * 32-bit dst. Pixels are scaled by the largest integer factor that fits
+ * (320x200 becomes 960x600 in 1024x768) and the image is centred. */
+void gfx_present_scaled(gfx_surface_t *src, const gfx_palette_t *palette, gfx_surface_t *dst);
+
+#endif /* SARRUS_GFX_H */
@@ -0,0 +1,51 @@
+#ifndef SARRUS_IDT_H
+#define SARRUS_IDT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Exception vectors */
+#define VECTOR_DEVICE_NOT_AVAILABLE  7
+#define VECTOR_DOUBLE_FAULT          8
+#define VECTOR_GENERAL_PROTECTION    13
+#define VECTOR_PAGE_FAULT            14
+#define VECTOR_SIMD_EXCEPTION        19
+
+/* Hardware IRQs, remapped past the exceptions */
+#define IRQ_BASE           32
+#define IRQ_COUNT          16
+#define IRQ_TIMER          0
+#define IRQ_COM1           4
+
+#define IDT_ENTRIES        256
+#define IDT_GATE_INTERRUPT 0x8E  /* Present, ring 0, 32-bit interrupt gate */
+
+/* Register state pushed by isr_common (isr.asm), lowest address first */
+typedef struct interrupt_frame {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp_dummy, ebx, edx, ecx, eax;
+    uint32_t vector, error_code;
+    uint32_t eip, cs, eflags;
+} interrupt_frame_t;
+
+typedef void (*interrupt_handler_t)(interrupt_frame_t *frame);
+
+void idt_init(void);
+void idt_set_gate(uint8_t vector, uint32_t handler, uint8_t flags);
+void interrupt_register(uint8_t vector, interrupt_handler_t handler);
+void interrupt_dispatch(interrupt_frame_t *frame);
+
+/* Route a PIC line to a handler and unmask it; EOI is sent by the dispatcher */
+void irq_register(uint8_t irq, interrupt_handler_t handler);
+
+/* 8259 PIC pair (kernel/pic.c) */
+void pic_init(void);
+void pic_mask(uint8_t irq);
+void pic_unmask(uint8_t irq);
+void pic_eoi(uint8_t irq);
+int pic_is_spurious(uint8_t irq);
+
+/* Exception and IRQ stubs (isr.asm) */
+extern const uint32_t isr_stub_table[IRQ_BASE + IRQ_COUNT];
+
+#endif /* SARRUS_IDT_H */
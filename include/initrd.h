@@ -0,0 +1,65 @@
+#ifndef SARRUS_INITRD_H
+#define SARRUS_INITRD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Initial ramdisk image, as written by tools/mkinitrd.c:
+ *
+ *   initrd_header_t, then file_count initrd_entry_t, sorted by name
+ *   padding to the next page
+ *   file data, each file starting on a page boundary and zero-padded
+ *
+ * All fields are little endian. Offsets are from the start of the image.
+ */
+#define INITRD_MAGIC        0x44524E49  /* "INRD" */
+#define INITRD_VERSION      1
+#define INITRD_PAGE_SIZE    4096
+#define INITRD_NAME_MAX     56          /* Path relative to the packed directory, NUL included */
+
+typedef struct initrd_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t total_size;                /* Bytes, a multiple of INITRD_PAGE_SIZE */
+} initrd_header_t;
+
+typedef struct initrd_entry {
+    char name[INITRD_NAME_MAX];
+    uint32_t offset;                    /* Page aligned */
+    uint32_t size;
+} initrd_entry_t;
+
+typedef initrd_entry_t initrd_file_t;
+
+/* Find the GRUB module named "initrd" (or the first module that is an
+ * initrd image) and check it. Nothing is copied: the module stays where
+ * GRUB put it, and memory_init() places the early heap above it.
+ * ERROR_IO when there is none, ERROR_INVALID when it is malformed. */
+int initrd_init(void);
+int initrd_present(void);
+
+/* Look up a file by path; a leading '/' is optional. NULL if absent. */
+const initrd_file_t *initrd_open(const char *path);
+
+uint32_t initrd_count(void);
+const initrd_file_t *initrd_file(uint32_t index);
+
+/* The file's bytes inside the module, without a copy */
+const void *initrd_data(const initrd_file_t *file);
+
+/* Physical frame holding page index of the file, for mapping it elsewhere */
+uint32_t initrd_frame(const initrd_file_t *file, uint32_t page);
+
+/* Map the file read-only at virt (page aligned) from the module's own
+ * frames; extra flags such as PAGE_USER are added. Needs paging; without
+ * it, initrd_data() already is the mapping. */
+int initrd_map(const initrd_file_t *file, uint32_t virt, uint32_t flags);
+
+/* Copying read for callers that want their own buffer; returns bytes read */
+size_t initrd_read(const initrd_file_t *file, uint32_t offset, void *buf, size_t size);
+
+void initrd_list(void);
+
+#endif /* SARRUS_INITRD_H */
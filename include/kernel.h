@@ -1,6 +1,7 @@
 #ifndef SARRUS_KERNEL_H
 #define SARRUS_KERNEL_H
 
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 #include "memory.h"
@@ -46,19 +47,60 @@ void terminal_setcolor(uint8_t color);
 void terminal_putchar(char c);
 void terminal_write(const char* data, size_t size);
 void terminal_writestring(const char* data);
+void terminal_flush(void);
+void terminal_scroll_view(int lines);
+void terminal_set_cursor_shape(uint8_t start, uint8_t end);
+void terminal_show_cursor(int visible);
 
-/* Utility functions */
+/* Formatted output (kernel/kprintf.c); %k prints a byte count with units */
+int kprintf(const char* fmt, ...);
+int kvprintf(const char* fmt, va_list args);
+int ksnprintf(char* buf, size_t size, const char* fmt, ...);
+int kvsnprintf(char* buf, size_t size, const char* fmt, va_list args);
+
+/* Utility functions (libc/string.c) */
 size_t strlen(const char* str);
+size_t strnlen(const char* str, size_t max);
+int strcmp(const char* str1, const char* str2);
+int strncmp(const char* str1, const char* str2, size_t size);
+char* strchr(const char* str, int value);
+void* memchr(const void* ptr, int value, size_t size);
 
 /* Kernel panic */
-void panic(const char* message);
+void panic(const char* message) __attribute__((noreturn));
+
+/* Stack traces (frame-pointer walk bounded by the boot stack) */
+uint32_t stack_capture(uint32_t *frame, uint32_t *trace, uint32_t max);
+void stack_print(const uint32_t *trace, uint32_t depth);
 
 /* Assembly functions for paging */
 extern void enable_paging(uint32_t page_directory);
-extern void flush_tlb_single(uint32_t addr);
 extern uint32_t get_cr2(void);
 extern uint32_t get_cr3(void);
 
+/* Boot stack bounds (boot.asm) */
+extern uint8_t stack_bottom[];
+extern uint8_t stack_top[];
+
+/* Time Stamp Counter */
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Interrupt Flag */
+/* Disable interrupts, returning the previous EFLAGS for irq_restore() */
+static inline uint32_t irq_save(void) {
+    uint32_t eflags;
+    __asm__ volatile ("pushfl; popl %0; cli" : "=r"(eflags) : : "memory");
+    return eflags;
+}
+
+static inline void irq_restore(uint32_t eflags) {
+    __asm__ volatile ("pushl %0; popfl" : : "r"(eflags) : "memory", "cc");
+}
+
 /* I/O Port Functions */
 static inline void outb(uint16_t port, uint8_t val) {
     __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
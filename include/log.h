@@ -0,0 +1,58 @@
+#ifndef SARRUS_LOG_H
+#define SARRUS_LOG_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Log levels, most severe first */
+#define LOG_EMERG   0
+#define LOG_ALERT   1
+#define LOG_CRIT    2
+#define LOG_ERR     3
+#define LOG_WARN    4
+#define LOG_NOTICE  5
+#define LOG_INFO    6
+#define LOG_DEBUG   7
+
+#define LOG_RECORDS       256   /* Power of two */
+#define LOG_RECORD_SIZE   128   /* Bytes per record, header included */
+
+/* Append one line to the kernel log. Safe from any context, including
+ * interrupt handlers; never blocks and never touches a device once
+ * log_set_deferred() has run. A trailing '\n' is optional. Returns the
+ * record's sequence number. */
+uint32_t klog(int level, const char *fmt, ...);
+uint32_t vklog(int level, const char *fmt, va_list args);
+
+#define log_err(...)    klog(LOG_ERR, __VA_ARGS__)
+#define log_warn(...)   klog(LOG_WARN, __VA_ARGS__)
+#define log_notice(...) klog(LOG_NOTICE, __VA_ARGS__)
+#define log_info(...)   klog(LOG_INFO, __VA_ARGS__)
+#define log_debug(...)  klog(LOG_DEBUG, __VA_ARGS__)
+
+/* Print committed records not yet shown to the console (the consumer).
+ * Called from the idle loop; a concurrent call returns at once. */
+void log_flush(void);
+
+/* Panic path: print everything, skipping records whose writer never finished */
+void log_flush_sync(void);
+
+/* Until this is called, klog() flushes to the console itself (early boot) */
+void log_set_deferred(void);
+
+/* Only records at or above this severity reach the console; all are kept */
+void log_set_console_level(int level);
+
+/* Print every record still in the ring, with sequence, level and timestamp */
+void log_dump(void);
+
+/* Copy record seq into buf; returns its length, or -1 if it was overwritten
+ * or is not committed yet */
+int log_read(uint32_t seq, int *level, uint64_t *tsc, char *buf, size_t size);
+
+/* Sequence number the next record will get */
+uint32_t log_next_seq(void);
+uint32_t log_lost(void);
+
+#endif /* SARRUS_LOG_H */
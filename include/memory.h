@@ -20,13 +20,28 @@ int vmm_is_mapped(uint32_t virt_addr);
 #define KERNEL_PHYSICAL_BASE 0x100000   /* 1MB mark */
 #define HEAP_VIRTUAL_START 0xD0000000   /* Kernel heap start */
 #define HEAP_VIRTUAL_END   0xDFFFFFFF   /* Kernel heap end (256MB) */
+#define HEAP_EARLY_SIZE    (64 * 1024)  /* Physical heap used while paging is off */
 
 /* Page directory and table entries */
 #define PAGE_PRESENT    0x001
 #define PAGE_WRITABLE   0x002
 #define PAGE_USER       0x004
+#define PAGE_WRITETHROUGH 0x008  /* PWT */
+#define PAGE_NOCACHE    0x010    /* PCD */
 #define PAGE_ACCESSED   0x020
 #define PAGE_DIRTY      0x040
+#define PAGE_PAT        0x080    /* PAT index bit 2 in 4KB entries */
+#define PAGE_CACHE_MASK (PAGE_WRITETHROUGH | PAGE_NOCACHE | PAGE_PAT)
+
+/* Memory types for vmm_map_page_type() and vmm_map_mmio() */
+#define CACHE_WB        0   /* Write-back: RAM */
+#define CACHE_WC        1   /* Write-combining: framebuffers */
+#define CACHE_UC        2   /* Uncached: device registers */
+#define CACHE_WT        3   /* Write-through */
+
+/* Device memory (framebuffers, PCI BARs) is mapped from here up */
+#define MMIO_VIRTUAL_START 0xF0000000
+#define MMIO_VIRTUAL_END   0xFFBFFFFF
 
 /* Memory regions */
 typedef struct memory_region {
@@ -60,8 +75,14 @@ typedef struct heap_block {
     struct heap_block *prev;
     const char *file;      /* File where allocated (debug) */
     int line;              /* Line where allocated (debug) */
+    uint16_t flags;        /* HEAP_BLOCK_* flags */
+    uint16_t prof_site;    /* Heap profiler call site (if sampled) */
 } heap_block_t;
 
+/* Heap block flags */
+#define HEAP_BLOCK_SAMPLED  0x0001  /* Charged to a heap profiler site */
+#define HEAP_BLOCK_ATOMIC   0x0002  /* Owned by the atomic pool */
+
 /* Memory statistics */
 typedef struct memory_stats {
     size_t total_physical;
@@ -86,6 +107,15 @@ uint32_t pmm_get_free_pages(void);
 void vmm_init(void);
 void vmm_map_page(uint32_t virtual, uint32_t physical, uint32_t flags);
 void vmm_unmap_page(uint32_t virtual);
+void vmm_protect_page(uint32_t virtual, uint32_t flags); /* Keeps the frame */
+void vmm_map_page_type(uint32_t virtual, uint32_t physical, uint32_t flags, int type);
+uint32_t vmm_cache_bits(int type);  /* PTE bits selecting a CACHE_* type */
+
+/* Map size bytes of device memory at phys with the given CACHE_* type.
+ * Returns the virtual address, the physical one itself when paging is off,
+ * or NULL when the MMIO window is full. Never unmapped; not backed by RAM
+ * frames, so vmm_unmap_page() must not be used on it. */
+void *vmm_map_mmio(uint32_t phys, size_t size, int type);
 uint32_t vmm_get_physical(uint32_t virtual);
 int vmm_is_mapped(uint32_t virtual);
 
@@ -102,6 +132,20 @@ void *kmalloc_ap(size_t size, uint32_t *physical); /* Get physical address */
 void *kcalloc(size_t count, size_t size);
 void *krealloc(void *ptr, size_t size);
 void kfree(void *ptr);
+void *kmalloc_gfp(size_t size, uint32_t gfp);
+void heap_drain_deferred(void); /* Coalesce queued frees now */
+void heap_idle(void);           /* Idle-loop hook, drains deferred frees */
+
+/* Allocation flags for kmalloc_gfp() */
+#define GFP_KERNEL   0x0000  /* Process context, may coalesce the heap */
+#define GFP_ATOMIC   0x0001  /* Interrupt context, served from the atomic pool */
+#define GFP_NOFENCE  0x0002  /* Never sample into KFENCE (needs a heap header) */
+#define GFP_CACHELINE 0x0004 /* Own whole cache lines: for data written concurrently */
+
+#define CACHE_LINE_SIZE 64
+
+/* kfree() queues blocks and coalesces them in batches of this many */
+#define HEAP_DEFER_BATCH 32
 
 /* Debug allocations */
 #ifdef DEBUG_MEMORY
@@ -113,12 +157,99 @@ void heap_dump(void);
 void heap_check_integrity(void);
 #endif
 
-/* Memory utilities */
+/* Sampling heap profiler */
+#define HEAP_PROFILE_DEFAULT_RATE  4096  /* Mean bytes allocated between samples */
+#define HEAP_PROFILE_SITES         64    /* Call-site hash table size (power of two) */
+#define HEAP_PROFILE_DEPTH         6     /* Return addresses recorded per site */
+
+typedef struct heap_profile_site {
+    uint32_t hash;                        /* Stack hash, 0 = unused slot */
+    uint32_t depth;
+    uint32_t stack[HEAP_PROFILE_DEPTH];
+    size_t live_bytes;                    /* Estimated bytes still allocated */
+    size_t total_bytes;                   /* Estimated bytes ever allocated */
+    uint32_t samples;
+} heap_profile_site_t;
+
+/* Bytes left until the next sample; kmalloc() decrements it inline */
+extern int32_t heap_profile_countdown;
+
+void heap_profile_init(void);
+void heap_profile_set_rate(uint32_t rate);  /* 0 disables sampling */
+void heap_profile_sample(heap_block_t *block, size_t size);
+void heap_profile_release(heap_block_t *block);
+void heap_profile_reset(void);
+void heap_profile_dump(void);
+
+/* Interrupt-safe atomic allocation pool
+ *
+ * GFP_ATOMIC allocations come from per-size-class lock-free stacks of
+ * preallocated heap blocks. Interrupt handlers only pop and push; refilling
+ * and trimming happen in process context via atomic_pool_refill(). */
+#define ATOMIC_POOL_CLASSES   4     /* 64, 128, 256 and 512 bytes */
+#define ATOMIC_POOL_MIN_SIZE  64
+#define ATOMIC_POOL_MAX_SIZE  512
+#define ATOMIC_POOL_TARGET    4     /* Objects per class after a refill */
+#define ATOMIC_POOL_LOW       1     /* Reserve counted as running low below this */
+
+typedef struct atomic_pool_stats {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t low_events;   /* Allocations that left a class below ATOMIC_POOL_LOW */
+    uint32_t failures;     /* GFP_ATOMIC requests that found the reserve empty */
+    uint32_t refills;      /* Objects added by atomic_pool_refill() */
+    uint32_t available[ATOMIC_POOL_CLASSES];
+} atomic_pool_stats_t;
+
+void atomic_pool_init(void);
+void *atomic_pool_alloc(size_t size);
+void atomic_pool_free(heap_block_t *block);
+void atomic_pool_refill(void);
+void atomic_pool_get_stats(atomic_pool_stats_t *stats);
+void atomic_pool_print_stats(void);
+
+/* Sampled guard-page allocator (KFENCE-style)
+ *
+ * Objects live alone on a page flanked by unmapped guard pages. Out-of-bounds
+ * accesses and use-after-free fault immediately; the page fault handler hands
+ * the address to kfence_handle_fault() for a report. Needs paging. */
+#define KFENCE_VIRTUAL_START    0xE0000000
+#define KFENCE_NUM_OBJECTS      63
+#define KFENCE_POOL_SIZE        ((KFENCE_NUM_OBJECTS * 2 + 1) * PAGE_SIZE)
+#define KFENCE_SAMPLE_INTERVAL  500   /* Allocations between samples */
+#define KFENCE_STACK_DEPTH      4
+
+/* Allocations left until the next sample; kmalloc() decrements it inline */
+extern int32_t kfence_countdown;
+
+static inline int kfence_is_address(const void *ptr) {
+    return (uint32_t)ptr - KFENCE_VIRTUAL_START < KFENCE_POOL_SIZE;
+}
+
+void kfence_init(void);
+void *kfence_alloc(size_t size);
+void kfence_free(void *ptr);
+size_t kfence_ksize(const void *ptr);
+int kfence_handle_fault(uint32_t addr, int write);
+void kfence_print_stats(void);
+
+/* Memory utilities (libc/memcpy.c, libc/string.c) */
 void *memset(void *ptr, int value, size_t size);
 void *memcpy(void *dest, const void *src, size_t size);
 void *memmove(void *dest, const void *src, size_t size);
 int memcmp(const void *ptr1, const void *ptr2, size_t size);
 
+/* Non-temporal variants for large regions that will not be read back soon */
+void *memset_nt(void *ptr, int value, size_t size);
+void *memcpy_nt(void *dest, const void *src, size_t size);
+
+/* Check every copy/fill variant the CPU supports and memmove() overlaps
+ * against byte loops; prints PASSED or FAILED */
+void memops_selftest(void);
+
+/* Same for strlen, memchr and memcmp, including their SSE2 paths */
+void string_selftest(void);
+
 /* Memory region management */
 void memory_region_add(uint32_t start, uint32_t length, uint32_t type);
 memory_region_t *memory_region_find(uint32_t addr);
@@ -130,6 +261,7 @@ void memory_init_advanced(void);
 void memory_get_stats(memory_stats_t *stats);
 void memory_print_stats(void);
 void memory_test(void);
+void memory_bench_cacheline(void);
 
 /* Memory protection */
 void memory_protect_kernel(void);
@@ -144,5 +276,6 @@ int memory_check_access(uint32_t addr, size_t size, int write);
 /* Magic numbers for heap corruption detection */
 #define HEAP_MAGIC_ALLOC   0xDEADBEEF
 #define HEAP_MAGIC_FREE    0xFEEDFACE
+#define HEAP_MAGIC_DEFERRED 0xDEFE11ED  /* Freed, waiting in the deferred queue */
 
 #endif /* SARRUS_MEMORY_H */
@@ -0,0 +1,92 @@
+#ifndef SARRUS_MULTIBOOT_H
+#define SARRUS_MULTIBOOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Values in EAX at the kernel entry point */
+#define MULTIBOOT_BOOTLOADER_MAGIC   0x2BADB002
+#define MULTIBOOT2_BOOTLOADER_MAGIC  0x36D76289
+
+/* Memory map entry types (both protocols) */
+#define MULTIBOOT_MEMORY_AVAILABLE        1
+#define MULTIBOOT_MEMORY_RESERVED         2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT_MEMORY_NVS              4
+#define MULTIBOOT_MEMORY_BADRAM           5
+
+/* Framebuffer types */
+#define MULTIBOOT_FRAMEBUFFER_INDEXED   0
+#define MULTIBOOT_FRAMEBUFFER_RGB       1
+#define MULTIBOOT_FRAMEBUFFER_EGA_TEXT  2
+
+#define BOOT_MMAP_MAX       32
+#define BOOT_MODULES_MAX    8
+#define BOOT_CMDLINE_MAX    128
+#define BOOT_MODULE_NAME_MAX 64
+
+typedef struct boot_mmap_entry {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;                  /* MULTIBOOT_MEMORY_* */
+} boot_mmap_entry_t;
+
+typedef struct boot_module {
+    uint32_t start;                 /* Physical; page aligned when asked for */
+    uint32_t end;                   /* One past the last byte */
+    char cmdline[BOOT_MODULE_NAME_MAX];
+} boot_module_t;
+
+typedef struct boot_framebuffer {
+    uint64_t addr;                  /* Physical; 0 when there is none */
+    uint32_t pitch;
+    uint32_t width;
+    uint32_t height;
+    uint8_t bpp;
+    uint8_t type;                   /* MULTIBOOT_FRAMEBUFFER_* */
+    uint8_t red_pos, red_size;      /* RGB only */
+    uint8_t green_pos, green_size;
+    uint8_t blue_pos, blue_size;
+} boot_framebuffer_t;
+
+/* What the boot loader told us, copied out of its structures, which live
+ * in memory the kernel may reuse */
+typedef struct boot_info {
+    uint32_t protocol;              /* 1 or 2; 0 when not started by Multiboot */
+    char cmdline[BOOT_CMDLINE_MAX];
+    char loader[BOOT_MODULE_NAME_MAX];
+    uint32_t mem_lower;             /* KB below 1MB */
+    uint32_t mem_upper;             /* KB from 1MB to the first hole */
+    uint32_t mmap_count;
+    boot_mmap_entry_t mmap[BOOT_MMAP_MAX];
+    boot_framebuffer_t framebuffer;
+    uint32_t rsdp_size;             /* 20 (ACPI 1.0) or 36; 0 when not passed */
+    uint8_t rsdp[36];               /* Copy of the ACPI RSDP */
+    uint32_t module_count;
+    boot_module_t modules[BOOT_MODULES_MAX];
+    uint32_t symtab;                /* ELF .symtab and its .strtab, loaded by GRUB */
+    uint32_t symtab_size;
+    uint32_t strtab;
+    uint32_t strtab_size;
+} boot_info_t;
+
+extern boot_info_t boot_info;
+
+/* Copy the Multiboot 1 or 2 information at info into boot_info. Returns
+ * SUCCESS, or ERROR_INVALID when magic matches neither protocol. */
+int multiboot_parse(uint32_t magic, uint32_t info);
+
+/* Bytes of RAM the memory map marks available; 0 without a map */
+uint64_t multiboot_memory_available(void);
+
+/* Lowest page-aligned address from addr where size bytes of available RAM
+ * lie above the modules and ELF symbols, so nothing the loader left is
+ * overwritten. 0 if the memory map has no such room. */
+uint32_t multiboot_place(uint32_t addr, uint32_t size);
+
+void multiboot_print_info(void);
+
+/* Function containing addr from the kernel's ELF symbols, or NULL */
+const char *multiboot_symbol(uint32_t addr, uint32_t *offset);
+
+#endif /* SARRUS_MULTIBOOT_H */
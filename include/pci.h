@@ -0,0 +1,60 @@
+#ifndef SARRUS_PCI_H
+#define SARRUS_PCI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Configuration mechanism #1 */
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+/* Configuration space header (type 0) */
+#define PCI_VENDOR_ID       0x00
+#define PCI_DEVICE_ID       0x02
+#define PCI_COMMAND         0x04
+#define PCI_STATUS          0x06
+#define PCI_CLASS_REVISION  0x08
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_BAR0            0x10
+#define PCI_CAPABILITY_LIST 0x34
+#define PCI_INTERRUPT_LINE  0x3C
+
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_BUS_MASTER  0x0004
+#define PCI_STATUS_CAP_LIST     0x0010
+#define PCI_HEADER_MULTIFUNCTION 0x80
+#define PCI_BAR_IO              0x01
+#define PCI_BAR_TYPE_64         0x04
+#define PCI_VENDOR_NONE         0xFFFF
+
+/* Capability list entries: ID byte, then the offset of the next entry */
+#define PCI_CAP_ID              0x00
+#define PCI_CAP_NEXT            0x01
+#define PCI_CAP_ID_VENDOR       0x09
+
+typedef struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint16_t vendor;
+    uint16_t device;
+} pci_device_t;
+
+uint32_t pci_read32(const pci_device_t *dev, uint8_t offset);
+uint16_t pci_read16(const pci_device_t *dev, uint8_t offset);
+uint8_t pci_read8(const pci_device_t *dev, uint8_t offset);
+void pci_write32(const pci_device_t *dev, uint8_t offset, uint32_t value);
+void pci_write16(const pci_device_t *dev, uint8_t offset, uint16_t value);
+
+/* Scan every bus for vendor:device; fills *dev and returns SUCCESS when found */
+int pci_find_device(uint16_t vendor, uint16_t device, pci_device_t *dev);
+
+/* Physical base of a memory BAR, 0 for I/O or unassigned BARs. 64-bit BARs
+ * above 4GB are not reachable without PAE and also read as 0. */
+uint32_t pci_bar_address(const pci_device_t *dev, int bar);
+
+/* Enable memory decoding and bus mastering */
+void pci_enable_device(const pci_device_t *dev);
+
+#endif /* SARRUS_PCI_H */
@@ -0,0 +1,44 @@
+#ifndef SARRUS_PRESENT_H
+#define SARRUS_PRESENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "gfx.h"
+
+#define PRESENT_HISTORY   256   /* Frame times kept for the statistics */
+
+typedef struct present_stats {
+    uint32_t frames;
+    uint32_t missed;            /* Frames later than 1.5 intervals */
+    uint32_t vsync_timeouts;    /* Flips made without seeing a retrace */
+    uint32_t min_us;            /* Over the last PRESENT_HISTORY frames */
+    uint32_t avg_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+    uint32_t refresh_us;        /* Measured retrace period, 0 if unknown */
+    uint32_t flip_avg_us;       /* Cost of the flip or virtio-gpu flush itself */
+    uint32_t flip_max_us;
+    int virtio_gpu;             /* Frames went out through virtio-gpu */
+} present_stats_t;
+
+/* Pace presents to target_hz (e.g. 35 or 60); 0 flips on every retrace */
+void present_init(uint32_t target_hz);
+
+/* Present frames drawn into surface through virtio-gpu instead of the BGA
+ * pages; 32-bit, pitch width * 4, and it must stay put. ERROR_IO without
+ * the device. NULL goes back to BGA flips. */
+int present_set_surface(gfx_surface_t *surface);
+
+/* Show the frame. Sleeps until shortly before the frame is due, then sends
+ * the surface's damage to virtio-gpu, or else waits for the start of
+ * vertical retrace (bounded) and flips the BGA pages. */
+void present_frame(void);
+
+/* Wait for the start of the next vertical retrace; 0 if none was seen
+ * within timeout_us */
+int vga_wait_vblank(uint32_t timeout_us);
+
+void present_get_stats(present_stats_t *stats);
+void present_print_stats(void);
+
+#endif /* SARRUS_PRESENT_H */
@@ -0,0 +1,31 @@
+#ifndef SARRUS_SERIAL_H
+#define SARRUS_SERIAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SERIAL_COM1       0x3F8
+#define SERIAL_BAUD       115200
+#define SERIAL_TX_RING    4096  /* Bytes, power of two */
+
+/* Probe and program COM1; output is polled until serial_enable_irq() */
+void serial_init(void);
+
+/* Switch to THRE-interrupt transmission from the TX ring (needs the PIC set up) */
+void serial_enable_irq(void);
+
+/* Back to polled output, draining the ring first; used by panic() */
+void serial_set_polled(void);
+
+/* Queue bytes for transmission. Never blocks in interrupt mode: if the
+ * ring is full, the excess is dropped and counted. '\n' is sent as "\r\n". */
+void serial_write(const char *data, size_t size);
+
+/* Wait until everything queued has reached the UART, so a following burst
+ * of up to SERIAL_TX_RING bytes cannot be dropped. Needs interrupts on. */
+void serial_drain(void);
+
+int serial_present(void);
+uint32_t serial_dropped(void);
+
+#endif /* SARRUS_SERIAL_H */
@@ -0,0 +1,24 @@
+#ifndef SARRUS_TIMER_H
+#define SARRUS_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PIT_FREQUENCY  1193182  /* Input clock, Hz */
+#define TIMER_HZ       1000     /* Tick rate of PIT channel 0 */
+#define TIMER_TICK_US  (1000000 / TIMER_HZ)
+
+/* Calibrate the TSC against PIT channel 2, then start the tick on IRQ 0 */
+void timer_init(void);
+
+/* Ticks since timer_init() */
+uint32_t timer_ticks(void);
+
+/* Microseconds since boot: from the TSC once calibrated, else from ticks */
+uint64_t timer_now_us(void);
+
+/* Sleep until timer_now_us() reaches deadline. Halts between ticks while
+ * interrupts are enabled and spins with pause only for the last tick. */
+void timer_sleep_until(uint64_t deadline_us);
+
+#endif /* SARRUS_TIMER_H */
@@ -0,0 +1,108 @@
+#ifndef SARRUS_VIRTIO_H
+#define SARRUS_VIRTIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pci.h"
+
+/* Virtio 1.x over PCI ("modern" devices only) */
+#define VIRTIO_PCI_VENDOR       0x1AF4
+#define VIRTIO_PCI_DEVICE(id)   (0x1040 + (id))
+#define VIRTIO_ID_GPU           16
+
+/* Device status */
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FEATURES_OK   0x08
+#define VIRTIO_STATUS_FAILED        0x80
+
+#define VIRTIO_F_VERSION_1      32      /* Feature bit; always negotiated */
+
+/* Split virtqueue */
+#define VIRTQ_DESC_F_NEXT       0x0001
+#define VIRTQ_DESC_F_WRITE      0x0002  /* Device writes this buffer */
+
+typedef struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct virtq_avail {
+    uint16_t flags;
+    volatile uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct virtq_used_elem {
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed)) virtq_used_elem_t;
+
+typedef struct virtq_used {
+    uint16_t flags;
+    volatile uint16_t idx;
+    virtq_used_elem_t ring[];
+} __attribute__((packed)) virtq_used_t;
+
+/* Bytes of queue memory for size entries: descriptors, then the available
+ * ring, then the used ring at the next 4-byte boundary */
+#define VIRTQ_USED_OFFSET(size) (((size) * 16 + 6 + (size) * 2 + 3) & ~3u)
+#define VIRTQ_BYTES(size)       (VIRTQ_USED_OFFSET(size) + 6 + (size) * 8)
+
+typedef struct virtq {
+    uint16_t index;                 /* Queue number on the device */
+    uint16_t size;                  /* Entries, a power of two */
+    virtq_desc_t *desc;
+    virtq_avail_t *avail;
+    virtq_used_t *used;
+    uint16_t avail_idx;             /* Next avail slot; published by virtq_kick */
+    uint16_t used_idx;              /* Used entries already consumed */
+    volatile uint16_t *notify;
+} virtq_t;
+
+typedef struct virtio_device {
+    pci_device_t pci;
+    volatile uint8_t *common;       /* struct virtio_pci_common_cfg */
+    volatile uint8_t *notify;
+    uint32_t notify_multiplier;
+    volatile uint8_t *isr;
+    volatile uint8_t *config;       /* Device-specific configuration */
+} virtio_device_t;
+
+/* Find the PCI function for a virtio device ID, map its configuration
+ * structures, reset it and acknowledge it. ERROR_IO if absent or legacy. */
+int virtio_pci_init(virtio_device_t *dev, uint16_t device_id);
+
+/* Accept the offered subset of features (VIRTIO_F_VERSION_1 is added).
+ * Returns SUCCESS, or ERROR_IO when the device rejects the set. */
+int virtio_negotiate(virtio_device_t *dev, uint64_t features);
+
+/* Set up queue index in caller-provided, 16-byte aligned, zeroed memory of
+ * VIRTQ_BYTES(size). size may be lowered to the device's maximum. */
+int virtio_queue_init(virtio_device_t *dev, virtq_t *queue, uint16_t index,
+                      void *memory, uint16_t size);
+
+/* Features and queues are set up; the device may start working */
+void virtio_driver_ok(virtio_device_t *dev);
+void virtio_fail(virtio_device_t *dev);
+
+/* Bus address of a kernel buffer, for descriptors and backing lists */
+uint64_t virtio_dma_address(const void *buffer);
+
+/* Fill descriptor i; flags VIRTQ_DESC_F_NEXT chains to next */
+void virtq_set_desc(virtq_t *queue, uint16_t i, const void *buffer, uint32_t len,
+                    uint16_t flags, uint16_t next);
+
+/* Queue the chain starting at head. Nothing reaches the device until
+ * virtq_kick(), so a batch costs one notification. */
+void virtq_submit(virtq_t *queue, uint16_t head);
+void virtq_kick(virtq_t *queue);
+
+/* Spin until the device has used everything submitted. Returns SUCCESS, or
+ * ERROR_IO after timeout_us. */
+int virtq_wait_idle(virtq_t *queue, uint32_t timeout_us);
+
+#endif /* SARRUS_VIRTIO_H */
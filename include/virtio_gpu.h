@@ -0,0 +1,34 @@
+#ifndef SARRUS_VIRTIO_GPU_H
+#define SARRUS_VIRTIO_GPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "gfx.h"
+
+/* virtio-gpu 2D (QEMU -device virtio-gpu-pci, or -vga virtio) */
+#define VIRTIO_GPU_QUEUE_SIZE   64      /* Control queue entries */
+#define VIRTIO_GPU_MAX_BACKING  64      /* Physically contiguous runs per resource */
+#define VIRTIO_GPU_TIMEOUT_US   100000  /* Per batch of commands */
+
+/* Probe the device, set up its control queue and read the display size.
+ * ERROR_IO if there is no modern virtio-gpu. */
+int virtio_gpu_init(void);
+int virtio_gpu_present(void);
+
+/* Preferred size of scanout 0, as the host window reports it */
+void virtio_gpu_display_size(uint32_t *width, uint32_t *height);
+
+/* Show a 32-bit 0x00RRGGBB surface on scanout 0. Its pixels become the
+ * host resource's backing store, so they must stay put; pitch must be
+ * width * 4. Replaces the previous surface. */
+int virtio_gpu_set_surface(gfx_surface_t *surface);
+
+/* Send the surface's damage to the host: one transfer per damaged
+ * rectangle and one flush, in a single queue notification. Returns when
+ * the host is done with the pixels. */
+int virtio_gpu_flush(gfx_surface_t *surface);
+
+/* Stop scanning out; the host falls back to its own display */
+void virtio_gpu_disable(void);
+
+#endif /* SARRUS_VIRTIO_GPU_H */
@@ -0,0 +1,107 @@
+; isr.asm - Interrupt and exception entry stubs
+
+section .text
+extern interrupt_dispatch
+
+; Exceptions without an error code push a dummy one so every frame has the
+; same layout (see interrupt_frame_t in idt.h)
+%macro ISR_NOERR 1
+global isr%1
+isr%1:
+    push dword 0                ; Dummy error code
+    push dword %1               ; Vector number
+    jmp isr_common
+%endmacro
+
+%macro ISR_ERR 1
+global isr%1
+isr%1:
+    push dword %1               ; Vector number (CPU pushed the error code)
+    jmp isr_common
+%endmacro
+
+ISR_NOERR 0                     ; #DE divide error
+ISR_NOERR 1                     ; #DB debug
+ISR_NOERR 2                     ; NMI
+ISR_NOERR 3                     ; #BP breakpoint
+ISR_NOERR 4                     ; #OF overflow
+ISR_NOERR 5                     ; #BR bound range
+ISR_NOERR 6                     ; #UD invalid opcode
+ISR_NOERR 7                     ; #NM device not available
+ISR_ERR   8                     ; #DF double fault
+ISR_NOERR 9                     ; Coprocessor segment overrun
+ISR_ERR   10                    ; #TS invalid TSS
+ISR_ERR   11                    ; #NP segment not present
+ISR_ERR   12                    ; #SS stack fault
+ISR_ERR   13                    ; #GP general protection
+ISR_ERR   14                    ; #PF page fault
+ISR_NOERR 15                    ; Reserved
+ISR_NOERR 16                    ; #MF x87 floating point
+ISR_ERR   17                    ; #AC alignment check
+ISR_NOERR 18                    ; #MC machine check
+ISR_NOERR 19                    ; #XM SIMD floating point
+ISR_NOERR 20                    ; #VE virtualization
+ISR_ERR   21                    ; #CP control protection
+ISR_NOERR 22
+ISR_NOERR 23
+ISR_NOERR 24
+ISR_NOERR 25
+ISR_NOERR 26
+ISR_NOERR 27
+ISR_NOERR 28
+ISR_ERR   29                    ; #VC VMM communication
+ISR_ERR   30                    ; #SX security
+ISR_NOERR 31
+
+; Hardware IRQs, remapped by pic_init() to vectors 32-47
+ISR_NOERR 32                    ; IRQ0 PIT timer
+ISR_NOERR 33                    ; IRQ1 keyboard
+ISR_NOERR 34                    ; IRQ2 cascade
+ISR_NOERR 35                    ; IRQ3 COM2
+ISR_NOERR 36                    ; IRQ4 COM1
+ISR_NOERR 37                    ; IRQ5
+ISR_NOERR 38                    ; IRQ6 floppy
+ISR_NOERR 39                    ; IRQ7 LPT1 / spurious
+ISR_NOERR 40                    ; IRQ8 RTC
+ISR_NOERR 41                    ; IRQ9
+ISR_NOERR 42                    ; IRQ10
+ISR_NOERR 43                    ; IRQ11
+ISR_NOERR 44                    ; IRQ12 PS/2 mouse
+ISR_NOERR 45                    ; IRQ13 FPU
+ISR_NOERR 46                    ; IRQ14 ATA primary
+ISR_NOERR 47                    ; IRQ15 ATA secondary / spurious
+
+; Save state, call the C dispatcher with a pointer to the frame, restore
+isr_common:
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+
+    mov ax, ss                  ; Kernel data segment
+    mov ds, ax
+    mov es, ax
+    cld
+
+    push esp                    ; interrupt_frame_t *
+    call interrupt_dispatch
+    add esp, 4
+
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popa
+    add esp, 8                  ; Drop vector and error code
+    iret
+
+; Stub addresses, indexed by vector
+section .rodata
+global isr_stub_table
+isr_stub_table:
+%assign i 0
+%rep 48
+    dd isr%+i
+%assign i i+1
+%endrep
@@ -2,7 +2,6 @@
 
 section .text
 global enable_paging
-global flush_tlb_single
 global get_cr2
 global get_cr3
 
@@ -28,18 +27,6 @@ enable_paging:
     pop ebp
     ret
 
-; Flush a single page from TLB
-; void flush_tlb_single(uint32_t virtual_address)
-flush_tlb_single:
-    push ebp
-    mov ebp, esp
-    
-    mov eax, [ebp + 8]  ; virtual_address parameter
-    invlpg [eax]        ; Invalidate page in TLB
-    
-    pop ebp
-    ret
-
 ; Get CR2 register (page fault address)
 ; uint32_t get_cr2(void)
 get_cr2:
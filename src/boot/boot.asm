@@ -1,5 +1,5 @@
 ; Sarrus OS Bootloader
-; Basic multiboot-compliant bootloader
+; Multiboot 1 and Multiboot 2 compliant entry point
 
 MBALIGN  equ  1<<0              ; align loaded modules on page boundaries
 MEMINFO  equ  1<<1              ; provide memory map
@@ -7,6 +7,14 @@ FLAGS    equ  MBALIGN | MEMINFO ; this is the Multiboot 'flag' field
 MAGIC    equ  0x1BADB002        ; 'magic number' lets bootloader find the header
 CHECKSUM equ -(MAGIC + FLAGS)   ; checksum of above, to prove we are multiboot
 
+; Multiboot 2: ask for a linear framebuffer and page-aligned modules
+MB2_MAGIC    equ 0xE85250D6
+MB2_ARCH     equ 0              ; i386 protected mode
+MB2_TAG_END          equ 0
+MB2_TAG_FRAMEBUFFER  equ 5
+MB2_TAG_MODULE_ALIGN equ 6
+MB2_TAG_OPTIONAL     equ 1      ; boot anyway if the loader cannot honour it
+
 ; Declare multiboot header
 section .multiboot
 align 4
@@ -14,9 +22,39 @@ align 4
     dd FLAGS
     dd CHECKSUM
 
+; Multiboot 2 header; GRUB's multiboot2 command finds this one
+align 8
+mb2_header_start:
+    dd MB2_MAGIC
+    dd MB2_ARCH
+    dd mb2_header_end - mb2_header_start
+    dd 0x100000000 - (MB2_MAGIC + MB2_ARCH + (mb2_header_end - mb2_header_start))
+
+    ; Preferred mode; without it GRUB leaves the adapter in text mode
+align 8
+    dw MB2_TAG_FRAMEBUFFER
+    dw MB2_TAG_OPTIONAL
+    dd 20
+    dd 1024                     ; width
+    dd 768                      ; height
+    dd 32                       ; depth
+
+align 8
+    dw MB2_TAG_MODULE_ALIGN
+    dw 0
+    dd 8
+
+align 8
+    dw MB2_TAG_END
+    dw 0
+    dd 8
+mb2_header_end:
+
 ; Reserve stack space
 section .bss
 align 16
+global stack_bottom
+global stack_top
 stack_bottom:
 resb 16384 ; 16 KiB
 stack_top:
@@ -28,7 +66,11 @@ start:
     ; Set up stack
     mov esp, stack_top
 
-    ; Call kernel main function
+    ; kernel_main(magic, info): EAX tells Multiboot 1 from 2, EBX points at
+    ; the boot information. Keep ESP 16-byte aligned at the call.
+    sub esp, 8
+    push ebx
+    push eax
     extern kernel_main
     call kernel_main
 
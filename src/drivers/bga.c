@@ -0,0 +1,169 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "pci.h"
+#include "log.h"
+#include "bga.h"
+
+/*
+ * Bochs Graphics Adapter
+ *
+ * The "DISPI" interface is an index/data register pair at 0x1CE/0x1CF. A
+ * mode is set by disabling the display, writing resolution and depth, and
+ * enabling it again with the linear framebuffer. The framebuffer address is
+ * BAR0 of the 1234:1111 PCI function.
+ *
+ * Double buffering uses the virtual screen. It is made twice as tall as the
+ * mode, and the display shows the page selected by the Y offset register.
+ * Presenting a frame therefore costs two port writes, not a framebuffer
+ * copy. The adapter latches the offset for the next refresh, so a page is
+ * never shown half-drawn once the caller has stopped writing to it.
+ *
+ * The framebuffer is mapped write-combining, so the CPU merges stores into
+ * full bursts instead of sending each one to the device uncached.
+ */
+
+#define BGA_INDEX_PORT  0x01CE
+#define BGA_DATA_PORT   0x01CF
+
+#define BGA_INDEX_ID            0x0
+#define BGA_INDEX_XRES          0x1
+#define BGA_INDEX_YRES          0x2
+#define BGA_INDEX_BPP           0x3
+#define BGA_INDEX_ENABLE        0x4
+#define BGA_INDEX_BANK          0x5
+#define BGA_INDEX_VIRT_WIDTH    0x6
+#define BGA_INDEX_VIRT_HEIGHT   0x7
+#define BGA_INDEX_X_OFFSET      0x8
+#define BGA_INDEX_Y_OFFSET      0x9
+#define BGA_INDEX_VIDEO_MEMORY  0xA     /* In 64KB units */
+
+#define BGA_ID_MIN          0xB0C2      /* Oldest version with LFB and virtual screen */
+#define BGA_ID_MAX          0xB0C5
+#define BGA_DISABLED        0x00
+#define BGA_ENABLED         0x01
+#define BGA_LFB_ENABLED     0x40
+#define BGA_VRAM_DEFAULT    (16 * 1024 * 1024)  /* Mapped when the size is unknown */
+
+static int bga_ok;
+static uint16_t bga_version;
+static uint32_t bga_lfb_phys;
+static uint8_t *bga_lfb;
+static uint32_t bga_vram;
+static bga_mode_t bga_mode;
+
+static inline void bga_write(uint16_t index, uint16_t value) {
+    outw(BGA_INDEX_PORT, index);
+    outw(BGA_DATA_PORT, value);
+}
+
+static inline uint16_t bga_read(uint16_t index) {
+    outw(BGA_INDEX_PORT, index);
+    return inw(BGA_DATA_PORT);
+}
+
+int bga_init(void) {
+    uint16_t id = bga_read(BGA_INDEX_ID);
+    if (id < BGA_ID_MIN || id > BGA_ID_MAX) {
+        return ERROR_IO;
+    }
+
+    pci_device_t dev;
+    bga_lfb_phys = BGA_DEFAULT_LFB;
+    if (pci_find_device(BGA_PCI_VENDOR, BGA_PCI_DEVICE, &dev) == SUCCESS) {
+        uint32_t bar = pci_bar_address(&dev, 0);
+        if (bar) {
+            bga_lfb_phys = bar;
+        }
+        pci_enable_device(&dev);
+    }
+
+    /* Older versions do not report the size; 0 means unknown */
+    bga_vram = id >= 0xB0C4 ? (uint32_t)bga_read(BGA_INDEX_VIDEO_MEMORY) << 16 : 0;
+    bga_lfb = vmm_map_mmio(bga_lfb_phys, bga_vram ? bga_vram : BGA_VRAM_DEFAULT, CACHE_WC);
+    if (!bga_lfb) {
+        return ERROR_NOMEM;
+    }
+    bga_version = id;
+    bga_ok = 1;
+
+    log_info("BGA: version %x, framebuffer at %p, %k video memory",
+             id, (void *)bga_lfb_phys, (size_t)bga_vram);
+    return SUCCESS;
+}
+
+int bga_present(void) {
+    return bga_ok;
+}
+
+int bga_set_mode(uint32_t width, uint32_t height, uint32_t bpp) {
+    if (!bga_ok || !width || !height || width > BGA_MAX_WIDTH || height > BGA_MAX_HEIGHT) {
+        return ERROR_INVALID;
+    }
+    if (bpp != 8 && bpp != 15 && bpp != 16 && bpp != 24 && bpp != 32) {
+        return ERROR_INVALID;
+    }
+
+    uint32_t pitch = width * ((bpp + 7) / 8);
+    if (bga_vram && pitch * height > bga_vram) {
+        return ERROR_INVALID;
+    }
+
+    bga_write(BGA_INDEX_ENABLE, BGA_DISABLED);
+    bga_write(BGA_INDEX_XRES, width);
+    bga_write(BGA_INDEX_YRES, height);
+    bga_write(BGA_INDEX_BPP, bpp);
+    bga_write(BGA_INDEX_ENABLE, BGA_ENABLED | BGA_LFB_ENABLED);
+
+    /* Enabling resets the virtual screen; ask for two pages and see what fits */
+    bga_write(BGA_INDEX_VIRT_WIDTH, width);
+    bga_write(BGA_INDEX_VIRT_HEIGHT, height * 2);
+    bga_write(BGA_INDEX_X_OFFSET, 0);
+    bga_write(BGA_INDEX_Y_OFFSET, 0);
+
+    bga_mode.width = bga_read(BGA_INDEX_XRES);
+    bga_mode.height = bga_read(BGA_INDEX_YRES);
+    bga_mode.bpp = bpp;
+    bga_mode.pitch = bga_read(BGA_INDEX_VIRT_WIDTH) * ((bpp + 7) / 8);
+    bga_mode.buffers = bga_read(BGA_INDEX_VIRT_HEIGHT) >= height * 2 ? 2 : 1;
+    bga_mode.front = 0;
+    bga_mode.lfb = bga_lfb;
+
+    if (bga_mode.width != width || bga_mode.height != height) {
+        bga_disable();
+        return ERROR_INVALID;
+    }
+
+    log_info("BGA: %ux%ux%u, %u page%s", width, height, bpp, bga_mode.buffers,
+             bga_mode.buffers > 1 ? "s" : "");
+    return SUCCESS;
+}
+
+void bga_disable(void) {
+    if (bga_ok) {
+        bga_write(BGA_INDEX_ENABLE, BGA_DISABLED);
+    }
+    bga_mode.width = bga_mode.height = 0;
+    bga_mode.lfb = NULL;
+}
+
+const bga_mode_t *bga_current_mode(void) {
+    return bga_mode.lfb ? &bga_mode : NULL;
+}
+
+uint8_t *bga_front_buffer(void) {
+    return bga_mode.lfb + bga_mode.front * bga_mode.height * bga_mode.pitch;
+}
+
+uint8_t *bga_back_buffer(void) {
+    uint32_t back = bga_mode.buffers > 1 ? bga_mode.front ^ 1 : bga_mode.front;
+    return bga_mode.lfb + back * bga_mode.height * bga_mode.pitch;
+}
+
+void bga_flip(void) {
+    if (bga_mode.buffers < 2) {
+        return;
+    }
+    bga_mode.front ^= 1;
+    bga_write(BGA_INDEX_Y_OFFSET, bga_mode.front * bga_mode.height);
+}
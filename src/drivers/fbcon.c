@@ -0,0 +1,255 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "gfx.h"
+#include "fbcon.h"
+
+/*
+ * Framebuffer text console
+ *
+ * The terminal keeps its 80x25 cell shadow (drivers/vga.c). In graphics mode,
+ * terminal_flush() draws its dirty lines here instead of copying them to
+ * VGA text memory.
+ *
+ * The font is the adapter's own 8x16 font. It is read out of VGA plane 2
+ * while still in text mode, or found in the video BIOS by its smiley glyph.
+ * Glyph rows are pre-expanded per colour pair: for each of the 256 possible
+ * 8-pixel bit patterns, the table holds the 8 finished 32-bit pixels.
+ * Drawing a cell is then 16 table lookups and 16 pairs of aligned 16-byte
+ * stores, with no per-pixel branches. The tables are 8KB each, and the
+ * FBCON_PAIR_CACHE most recently used pairs are kept.
+ *
+ * Cells are drawn into a RAM surface. Scrolling moves it with one blit,
+ * once per flush however many lines went by. fbcon_end() then copies the
+ * damaged part to the framebuffer with streaming stores, so the
+ * framebuffer is never read.
+ */
+
+#define FBCON_WIDTH   (FBCON_COLUMNS * FBCON_GLYPH_WIDTH)
+#define FBCON_HEIGHT  (FBCON_ROWS * FBCON_GLYPH_HEIGHT)
+
+#define VGA_SEQ_INDEX     0x3C4
+#define VGA_GC_INDEX      0x3CE
+#define VGA_PLANE_MEMORY  0xA0000
+#define VGA_FONT_STRIDE   32        /* Bytes per glyph slot in plane 2 */
+#define VGA_BIOS_START    0xC0000
+#define VGA_BIOS_END      0xC8000
+
+typedef struct glyph_rows {
+    uint32_t pixels[256][FBCON_GLYPH_WIDTH];
+} glyph_rows_t;
+
+static const uint32_t vga_palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+/* Glyph 1 of the IBM 8x16 font, the smiley */
+static const uint8_t font_signature[FBCON_GLYPH_HEIGHT] = {
+    0x00, 0x00, 0x7E, 0x81, 0xA5, 0x81, 0x81, 0xBD,
+    0x99, 0x81, 0x81, 0x7E, 0x00, 0x00, 0x00, 0x00,
+};
+
+static uint8_t font[256][FBCON_GLYPH_HEIGHT];
+static int font_ok;
+
+static glyph_rows_t pair_rows[FBCON_PAIR_CACHE] __attribute__((aligned(16)));
+static uint8_t pair_attr[FBCON_PAIR_CACHE];
+static uint32_t pair_used[FBCON_PAIR_CACHE];   /* 0: slot empty */
+static uint32_t pair_clock;
+
+static uint32_t console_pixels[FBCON_HEIGHT][FBCON_WIDTH] __attribute__((aligned(16)));
+static gfx_surface_t console;
+static gfx_surface_t screen;
+static int fbcon_on;
+static int fbcon_simd;
+
+/* Plane 2 holds the font; map it at 0xA0000 for reading, then restore text mode */
+static int font_from_plane2(void) {
+    outw(VGA_SEQ_INDEX, 0x0402);    /* Map mask: plane 2 */
+    outw(VGA_SEQ_INDEX, 0x0704);    /* Memory mode: sequential, no odd/even */
+    outw(VGA_GC_INDEX, 0x0204);     /* Read map select: plane 2 */
+    outw(VGA_GC_INDEX, 0x0005);     /* Mode: no odd/even */
+    outw(VGA_GC_INDEX, 0x0406);     /* Misc: map 0xA0000-0xAFFFF */
+
+    const uint8_t *plane = (const uint8_t *)VGA_PLANE_MEMORY;
+    for (uint32_t c = 0; c < 256; c++) {
+        memcpy(font[c], plane + c * VGA_FONT_STRIDE, FBCON_GLYPH_HEIGHT);
+    }
+
+    outw(VGA_SEQ_INDEX, 0x0302);
+    outw(VGA_SEQ_INDEX, 0x0304);
+    outw(VGA_GC_INDEX, 0x0004);
+    outw(VGA_GC_INDEX, 0x1005);
+    outw(VGA_GC_INDEX, 0x0E06);     /* Back to 0xB8000 text memory */
+
+    return memcmp(font[1], font_signature, FBCON_GLYPH_HEIGHT) == 0;
+}
+
+static int font_from_bios(void) {
+    const uint8_t *p = (const uint8_t *)VGA_BIOS_START + FBCON_GLYPH_HEIGHT;
+    const uint8_t *end = (const uint8_t *)VGA_BIOS_END - 255 * FBCON_GLYPH_HEIGHT;
+
+    for (; p < end; p++) {
+        if (p[2] == font_signature[2] && memcmp(p, font_signature, FBCON_GLYPH_HEIGHT) == 0) {
+            memcpy(font, p - FBCON_GLYPH_HEIGHT, sizeof(font));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Graphics mode, e.g. set by the boot loader: plane 2 no longer holds the font */
+static int vga_text_mode(void) {
+    outb(VGA_GC_INDEX, 0x06);
+    return !(inb(VGA_GC_INDEX + 1) & 0x01);
+}
+
+int fbcon_init(void) {
+    font_ok = (vga_text_mode() && font_from_plane2()) || font_from_bios();
+    return font_ok ? SUCCESS : ERROR_IO;
+}
+
+int fbcon_attach(void *framebuffer, uint32_t width, uint32_t height, uint32_t pitch,
+                 uint32_t bpp) {
+    if (!font_ok || bpp != 32 || width < FBCON_WIDTH || height < FBCON_HEIGHT) {
+        return ERROR_INVALID;
+    }
+
+    uint32_t left = (width - FBCON_WIDTH) / 2;
+    uint32_t top = (height - FBCON_HEIGHT) / 2;
+    uint8_t *origin = (uint8_t *)framebuffer + top * pitch + left * sizeof(uint32_t);
+
+    /* Clear the border once; only the cell area is touched later */
+    for (uint32_t y = 0; y < height; y++) {
+        memset_nt((uint8_t *)framebuffer + y * pitch, 0, width * sizeof(uint32_t));
+    }
+
+    gfx_surface_init(&console, console_pixels, FBCON_WIDTH, FBCON_HEIGHT,
+                     FBCON_WIDTH * sizeof(uint32_t), 32);
+    gfx_surface_init(&screen, origin, FBCON_WIDTH, FBCON_HEIGHT, pitch, 32);
+    fbcon_on = 1;
+    return SUCCESS;
+}
+
+void fbcon_detach(void) {
+    fbcon_on = 0;
+}
+
+int fbcon_active(void) {
+    return fbcon_on;
+}
+
+static const glyph_rows_t *rows_for(uint8_t attr) {
+    uint32_t victim = 0;
+
+    pair_clock++;
+    for (uint32_t i = 0; i < FBCON_PAIR_CACHE; i++) {
+        if (pair_used[i] && pair_attr[i] == attr) {
+            pair_used[i] = pair_clock;
+            return &pair_rows[i];
+        }
+        if (pair_used[i] < pair_used[victim]) {
+            victim = i;
+        }
+    }
+
+    /* Expand every 8-pixel pattern once for this pair */
+    uint32_t fg = vga_palette[attr & 0x0F];
+    uint32_t bg = vga_palette[(attr >> 4) & 0x0F];
+    glyph_rows_t *rows = &pair_rows[victim];
+    for (uint32_t bits = 0; bits < 256; bits++) {
+        for (uint32_t x = 0; x < FBCON_GLYPH_WIDTH; x++) {
+            rows->pixels[bits][x] = (bits & (0x80 >> x)) ? fg : bg;
+        }
+    }
+    pair_attr[victim] = attr;
+    pair_used[victim] = pair_clock;
+    return rows;
+}
+
+/* One cell: per glyph row, two aligned 16-byte stores of pre-expanded pixels */
+__attribute__((target("sse2"), noinline))
+static void sse2_draw_cell(uint32_t *d, const glyph_rows_t *rows, const uint8_t *glyph) {
+    uint32_t scratch;
+    uint32_t count = FBCON_GLYPH_HEIGHT;
+
+    __asm__ volatile ("1:\n\t"
+                      "movzbl (%2), %0\n\t"
+                      "shll $5, %0\n\t"
+                      "movdqa   (%3,%0), %%xmm0\n\t"
+                      "movdqa 16(%3,%0), %%xmm1\n\t"
+                      "movdqa %%xmm0,   (%1)\n\t"
+                      "movdqa %%xmm1, 16(%1)\n\t"
+                      "addl %5, %1\n\t"
+                      "incl %2\n\t"
+                      "decl %4\n\t"
+                      "jnz 1b"
+                      : "=&r"(scratch), "+r"(d), "+r"(glyph), "+r"(rows), "+r"(count)
+                      : "i"(FBCON_WIDTH * sizeof(uint32_t))
+                      : "memory", "cc", "xmm0", "xmm1");
+}
+
+static void draw_cell(uint32_t *d, const glyph_rows_t *rows, const uint8_t *glyph) {
+    if (fbcon_simd) {
+        sse2_draw_cell(d, rows, glyph);
+        return;
+    }
+    for (uint32_t y = 0; y < FBCON_GLYPH_HEIGHT; y++, d += FBCON_WIDTH) {
+        const uint32_t *src = rows->pixels[glyph[y]];
+        for (uint32_t x = 0; x < FBCON_GLYPH_WIDTH; x++) {
+            d[x] = src[x];
+        }
+    }
+}
+
+void fbcon_begin(void) {
+    fbcon_simd = cpu_has(CPU_FEATURE_SSE2) && kernel_fpu_usable() && (read_cr4() & CR4_OSFXSR);
+    if (fbcon_simd) {
+        kernel_fpu_begin();
+    }
+}
+
+void fbcon_end(void) {
+    if (fbcon_simd) {
+        kernel_fpu_end();
+    }
+    gfx_present(&console, &screen);
+}
+
+void fbcon_draw_line(uint32_t row, const uint16_t *cells) {
+    uint32_t *d = console_pixels[row * FBCON_GLYPH_HEIGHT];
+    const glyph_rows_t *rows = NULL;
+    uint8_t attr = 0;
+
+    for (uint32_t col = 0; col < FBCON_COLUMNS; col++, d += FBCON_GLYPH_WIDTH) {
+        uint8_t cell_attr = cells[col] >> 8;
+        if (!rows || cell_attr != attr) {
+            attr = cell_attr;
+            rows = rows_for(attr);
+        }
+        draw_cell(d, rows, font[cells[col] & 0xFF]);
+    }
+    gfx_damage(&console, 0, row * FBCON_GLYPH_HEIGHT, FBCON_WIDTH, FBCON_GLYPH_HEIGHT);
+}
+
+void fbcon_draw_cursor(uint32_t row, uint32_t col, uint8_t attr, uint8_t start, uint8_t end) {
+    uint32_t fg = vga_palette[attr & 0x0F];
+    uint32_t y = row * FBCON_GLYPH_HEIGHT;
+
+    for (uint32_t line = start; line <= end && line < FBCON_GLYPH_HEIGHT; line++) {
+        uint32_t *d = &console_pixels[y + line][col * FBCON_GLYPH_WIDTH];
+        for (uint32_t x = 0; x < FBCON_GLYPH_WIDTH; x++) {
+            d[x] = fg;
+        }
+    }
+    gfx_damage(&console, col * FBCON_GLYPH_WIDTH, y, FBCON_GLYPH_WIDTH, FBCON_GLYPH_HEIGHT);
+}
+
+/* Move the cell area up; the caller redraws the exposed lines */
+void fbcon_scroll(uint32_t lines) {
+    uint32_t dy = lines * FBCON_GLYPH_HEIGHT;
+    gfx_copy_rect(&console, 0, 0, 0, dy, FBCON_WIDTH, FBCON_HEIGHT - dy);
+}
@@ -0,0 +1,397 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "gfx.h"
+
+/*
+ * Graphics surfaces with damage tracking
+ *
+ * Drawing records the rectangles it changed. Presenting copies only those
+ * rectangles to the target, so the cost of a frame follows what changed.
+ * A status bar update or a few redrawn text cells cost a few kilobytes, not
+ * a full-screen copy.
+ *
+ * A new rectangle is merged with an existing one when their bounding box
+ * wastes at most GFX_MERGE_SLACK pixels. Overlapping and adjacent updates,
+ * such as consecutive glyphs on a line, thus become one rectangle. When the
+ * list is full, the new rectangle goes into the neighbour that grows the
+ * least. Once more than three quarters of the surface is damaged, the list
+ * collapses into one full-surface rectangle.
+ *
+ * Rows go to the target with memcpy_nt(). The target is normally a
+ * write-combining framebuffer that is never read back, so streaming stores
+ * avoid pulling it through the cache.
+ *
+ * 8-bit surfaces are shown through a gfx_palette_t. Its 32-bit lookup table
+ * is rebuilt only by gfx_palette_set(). Each source row is looked up once
+ * into an L1-resident line. At 2x and 3x, SSE2 then replicates every group
+ * of four pixels with unpack/pshufd and streams the result to each of the
+ * scale destination rows. At 3x, 320x200 becomes 3MB of stores per frame,
+ * about 2.3% of a core at 35Hz on a 3GB/s write-combined path.
+ */
+
+#define GFX_SCALE_LINE 2048     /* Widest 8-bit source row */
+
+static uint32_t scale_line[GFX_SCALE_LINE] __attribute__((aligned(16)));
+
+static inline uint32_t rect_area(const gfx_rect_t *r) {
+    return (uint32_t)r->w * (uint32_t)r->h;
+}
+
+static gfx_rect_t rect_union(const gfx_rect_t *a, const gfx_rect_t *b) {
+    int32_t x0 = a->x < b->x ? a->x : b->x;
+    int32_t y0 = a->y < b->y ? a->y : b->y;
+    int32_t x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    int32_t y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+    gfx_rect_t u = { x0, y0, x1 - x0, y1 - y0 };
+    return u;
+}
+
+/* Clip r to width x height; returns 0 when nothing is left */
+static int rect_clip(gfx_rect_t *r, uint32_t width, uint32_t height) {
+    if (r->x < 0) {
+        r->w += r->x;
+        r->x = 0;
+    }
+    if (r->y < 0) {
+        r->h += r->y;
+        r->y = 0;
+    }
+    if (r->x + r->w > (int32_t)width) {
+        r->w = (int32_t)width - r->x;
+    }
+    if (r->y + r->h > (int32_t)height) {
+        r->h = (int32_t)height - r->y;
+    }
+    return r->w > 0 && r->h > 0;
+}
+
+static void damage_add(gfx_rect_t *list, uint32_t *count, gfx_rect_t r,
+                       uint32_t width, uint32_t height) {
+    uint32_t i = 0;
+
+    /* Absorb every rectangle the new one overlaps or nearly touches */
+    while (i < *count) {
+        gfx_rect_t u = rect_union(&list[i], &r);
+        if (rect_area(&u) <= rect_area(&list[i]) + rect_area(&r) + GFX_MERGE_SLACK) {
+            r = u;
+            list[i] = list[--*count];
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+
+    while (*count == GFX_MAX_DAMAGE) {
+        uint32_t best = 0;
+        uint32_t best_growth = 0xFFFFFFFF;
+        for (i = 0; i < *count; i++) {
+            gfx_rect_t u = rect_union(&list[i], &r);
+            uint32_t growth = rect_area(&u) - rect_area(&list[i]);
+            if (growth < best_growth) {
+                best = i;
+                best_growth = growth;
+            }
+        }
+        r = rect_union(&list[best], &r);
+        list[best] = list[--*count];
+    }
+    list[(*count)++] = r;
+
+    uint32_t damaged = 0;
+    for (i = 0; i < *count; i++) {
+        damaged += rect_area(&list[i]);
+    }
+    if (damaged > width * height / 4 * 3) {
+        gfx_rect_t full = { 0, 0, (int32_t)width, (int32_t)height };
+        list[0] = full;
+        *count = 1;
+    }
+}
+
+void gfx_surface_init(gfx_surface_t *surface, void *pixels, uint32_t width, uint32_t height,
+                      uint32_t pitch, uint32_t bpp) {
+    surface->pixels = pixels;
+    surface->width = width;
+    surface->height = height;
+    surface->pitch = pitch;
+    surface->bpp = bpp;
+    surface->prev_count = 0;
+    surface->last_target = NULL;
+    surface->palette_version = 0;
+    gfx_damage_all(surface);
+}
+
+void gfx_damage(gfx_surface_t *surface, int32_t x, int32_t y, int32_t w, int32_t h) {
+    gfx_rect_t r = { x, y, w, h };
+
+    if (rect_clip(&r, surface->width, surface->height)) {
+        damage_add(surface->damage, &surface->damage_count, r, surface->width, surface->height);
+    }
+}
+
+void gfx_damage_all(gfx_surface_t *surface) {
+    surface->damage[0].x = 0;
+    surface->damage[0].y = 0;
+    surface->damage[0].w = (int32_t)surface->width;
+    surface->damage[0].h = (int32_t)surface->height;
+    surface->damage_count = 1;
+}
+
+void gfx_fill_rect(gfx_surface_t *surface, int32_t x, int32_t y, int32_t w, int32_t h,
+                   uint32_t color) {
+    gfx_rect_t r = { x, y, w, h };
+    if (!rect_clip(&r, surface->width, surface->height)) {
+        return;
+    }
+
+    uint32_t bytes = surface->bpp / 8;
+    uint8_t *row = surface->pixels + r.y * surface->pitch + r.x * bytes;
+    for (int32_t j = 0; j < r.h; j++, row += surface->pitch) {
+        if (bytes == 1) {
+            memset(row, (int)color, r.w);
+        } else if (bytes == 2) {
+            uint16_t *p = (uint16_t *)row;
+            for (int32_t i = 0; i < r.w; i++) {
+                p[i] = (uint16_t)color;
+            }
+        } else {
+            uint32_t *p = (uint32_t *)row;
+            for (int32_t i = 0; i < r.w; i++) {
+                p[i] = color;
+            }
+        }
+    }
+    damage_add(surface->damage, &surface->damage_count, r, surface->width, surface->height);
+}
+
+/* Move a rectangle within the surface; overlapping moves (scrolling) are fine */
+void gfx_copy_rect(gfx_surface_t *surface, int32_t dx, int32_t dy,
+                   int32_t sx, int32_t sy, int32_t w, int32_t h) {
+    int32_t width = (int32_t)surface->width;
+    int32_t height = (int32_t)surface->height;
+
+    /* Clip so that both the source and the destination stay inside */
+    if (sx < 0) { dx -= sx; w += sx; sx = 0; }
+    if (dx < 0) { sx -= dx; w += dx; dx = 0; }
+    if (sy < 0) { dy -= sy; h += sy; sy = 0; }
+    if (dy < 0) { sy -= dy; h += dy; dy = 0; }
+    if (w > width - sx) w = width - sx;
+    if (w > width - dx) w = width - dx;
+    if (h > height - sy) h = height - sy;
+    if (h > height - dy) h = height - dy;
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+
+    uint32_t bytes = surface->bpp / 8;
+    uint32_t pitch = surface->pitch;
+    uint8_t *from = surface->pixels + sy * pitch + sx * bytes;
+    uint8_t *to = surface->pixels + dy * pitch + dx * bytes;
+    size_t len = (size_t)w * bytes;
+
+    if (len == pitch) {
+        /* Whole lines: a single move */
+        memmove(to, from, len * h);
+    } else if (to > from) {
+        for (int32_t j = h - 1; j >= 0; j--) {
+            memmove(to + j * pitch, from + j * pitch, len);
+        }
+    } else {
+        for (int32_t j = 0; j < h; j++) {
+            memmove(to + j * pitch, from + j * pitch, len);
+        }
+    }
+
+    gfx_rect_t r = { dx, dy, w, h };
+    damage_add(surface->damage, &surface->damage_count, r, surface->width, surface->height);
+}
+
+/* This frame's damage, plus last frame's when the target changed */
+static uint32_t collect_damage(gfx_surface_t *src, const gfx_surface_t *dst, gfx_rect_t *list) {
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < src->damage_count; i++) {
+        damage_add(list, &count, src->damage[i], src->width, src->height);
+    }
+    if (src->last_target != dst) {
+        for (uint32_t i = 0; i < src->prev_count; i++) {
+            damage_add(list, &count, src->prev[i], src->width, src->height);
+        }
+    }
+
+    for (uint32_t i = 0; i < src->damage_count; i++) {
+        src->prev[i] = src->damage[i];
+    }
+    src->prev_count = src->damage_count;
+    src->damage_count = 0;
+    src->last_target = dst;
+    return count;
+}
+
+uint32_t gfx_take_damage(gfx_surface_t *src, const gfx_surface_t *dst, gfx_rect_t *list) {
+    uint32_t count = collect_damage(src, dst, list);
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (rect_clip(&list[i], dst->width, dst->height)) {
+            list[kept++] = list[i];
+        }
+    }
+    return kept;
+}
+
+void gfx_present(gfx_surface_t *src, gfx_surface_t *dst) {
+    gfx_rect_t list[GFX_MAX_DAMAGE];
+    uint32_t count = collect_damage(src, dst, list);
+    uint32_t bytes = src->bpp / 8;
+
+    for (uint32_t i = 0; i < count; i++) {
+        gfx_rect_t r = list[i];
+        if (!rect_clip(&r, dst->width, dst->height)) {
+            continue;
+        }
+
+        const uint8_t *from = src->pixels + r.y * src->pitch + r.x * bytes;
+        uint8_t *to = dst->pixels + r.y * dst->pitch + r.x * bytes;
+        size_t len = (size_t)r.w * bytes;
+
+        if (len == src->pitch && src->pitch == dst->pitch) {
+            memcpy_nt(to, from, len * r.h);
+            continue;
+        }
+        for (int32_t j = 0; j < r.h; j++) {
+            memcpy_nt(to + j * dst->pitch, from + j * src->pitch, len);
+        }
+    }
+}
+
+void gfx_palette_set(gfx_palette_t *palette, const uint8_t *rgb, uint32_t first, uint32_t count) {
+    for (uint32_t i = first; i < first + count && i < 256; i++, rgb += 3) {
+        palette->lut[i] = ((uint32_t)rgb[0] << 16) | ((uint32_t)rgb[1] << 8) | rgb[2];
+    }
+    palette->version++;
+}
+
+/* 2x: [c0 c1 c2 c3] becomes [c0 c0 c1 c1] [c2 c2 c3 c3]; d 16-byte aligned */
+__attribute__((target("sse2"), noinline))
+static void sse2_scale2_nt(uint32_t *d, const uint32_t *line, uint32_t quads) {
+    __asm__ volatile ("1:\n\t"
+                      "movdqa (%1), %%xmm0\n\t"
+                      "movdqa %%xmm0, %%xmm1\n\t"
+                      "punpckldq %%xmm0, %%xmm0\n\t"
+                      "punpckhdq %%xmm1, %%xmm1\n\t"
+                      "movntdq %%xmm0,   (%0)\n\t"
+                      "movntdq %%xmm1, 16(%0)\n\t"
+                      "addl $32, %0\n\t"
+                      "addl $16, %1\n\t"
+                      "decl %2\n\t"
+                      "jnz 1b"
+                      : "+r"(d), "+r"(line), "+r"(quads)
+                      : : "memory", "cc", "xmm0", "xmm1");
+}
+
+/* 3x: [c0 c0 c0 c1] [c1 c1 c2 c2] [c2 c3 c3 c3]; d 16-byte aligned */
+__attribute__((target("sse2"), noinline))
+static void sse2_scale3_nt(uint32_t *d, const uint32_t *line, uint32_t quads) {
+    __asm__ volatile ("1:\n\t"
+                      "movdqa (%1), %%xmm0\n\t"
+                      "pshufd $0x40, %%xmm0, %%xmm1\n\t"
+                      "pshufd $0xA5, %%xmm0, %%xmm2\n\t"
+                      "pshufd $0xFE, %%xmm0, %%xmm3\n\t"
+                      "movntdq %%xmm1,   (%0)\n\t"
+                      "movntdq %%xmm2, 16(%0)\n\t"
+                      "movntdq %%xmm3, 32(%0)\n\t"
+                      "addl $48, %0\n\t"
+                      "addl $16, %1\n\t"
+                      "decl %2\n\t"
+                      "jnz 1b"
+                      : "+r"(d), "+r"(line), "+r"(quads)
+                      : : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+/* Write one destination row: each of the n colours in line repeated scale times */
+static void scale_row(uint32_t *d, const uint32_t *line, uint32_t n, uint32_t scale, int simd) {
+    uint32_t done = 0;
+
+    if (scale == 1) {
+        memcpy_nt(d, line, n * sizeof(uint32_t));
+        return;
+    }
+    if (simd && !((uintptr_t)d & 15) && n >= 4) {
+        uint32_t quads = n / 4;
+        if (scale == 2) {
+            sse2_scale2_nt(d, line, quads);
+        } else {
+            sse2_scale3_nt(d, line, quads);
+        }
+        done = quads * 4;
+        d += done * scale;
+    }
+    for (uint32_t i = done; i < n; i++) {
+        for (uint32_t k = 0; k < scale; k++) {
+            *d++ = line[i];
+        }
+    }
+}
+
+void gfx_present_scaled(gfx_surface_t *src, const gfx_palette_t *palette, gfx_surface_t *dst) {
+    gfx_rect_t list[GFX_MAX_DAMAGE];
+
+    /* Check before taking the damage, so a rejected present loses nothing */
+    if (!src->width || !src->height || dst->bpp != 32 || src->bpp != 8 ||
+        src->width > GFX_SCALE_LINE) {
+        return;
+    }
+    uint32_t sx = dst->width / src->width;
+    uint32_t sy = dst->height / src->height;
+    uint32_t scale = sx < sy ? sx : sy;
+    if (!scale) {
+        return;
+    }
+
+    /* A new palette recolours every pixel: redraw the whole image, once per page */
+    if (src->palette_version != palette->version) {
+        src->palette_version = palette->version;
+        gfx_damage_all(src);
+    }
+    uint32_t count = collect_damage(src, dst, list);
+
+    uint32_t left = (dst->width - src->width * scale) / 2;
+    uint32_t top = (dst->height - src->height * scale) / 2;
+
+    /* 2x and 3x replicate in SSE registers; other scales stay scalar */
+    int simd = (scale == 2 || scale == 3) && cpu_has(CPU_FEATURE_SSE2) &&
+               kernel_fpu_usable() && (read_cr4() & CR4_OSFXSR);
+    if (simd) {
+        kernel_fpu_begin();
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        /* Whole quads of source pixels keep the SIMD stores aligned */
+        uint32_t x0 = list[i].x & ~3;
+        uint32_t x1 = (list[i].x + list[i].w + 3) & ~3;
+        x1 = x1 < src->width ? x1 : src->width;
+
+        uint8_t *to = dst->pixels + (top + list[i].y * scale) * dst->pitch +
+                      (left + x0 * scale) * sizeof(uint32_t);
+
+        for (int32_t j = 0; j < list[i].h; j++) {
+            /* The lookup itself is a gather, which SSE2 cannot do */
+            const uint8_t *from = src->pixels + (list[i].y + j) * src->pitch;
+            for (uint32_t x = x0; x < x1; x++) {
+                scale_line[x - x0] = palette->lut[from[x]];
+            }
+            for (uint32_t k = 0; k < scale; k++, to += dst->pitch) {
+                scale_row((uint32_t *)to, scale_line, x1 - x0, scale, simd);
+            }
+        }
+    }
+
+    if (simd) {
+        kernel_fpu_end();
+        __asm__ volatile ("sfence" : : : "memory");
+    }
+}
@@ -0,0 +1,94 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "pci.h"
+
+/*
+ * PCI configuration space through the 0xCF8/0xCFC ports
+ *
+ * Every access writes the address port and then the data port. Callers run
+ * in process context at boot, so there is no lock around the pair.
+ */
+
+#define PCI_ENABLE     0x80000000
+#define PCI_MAX_BUS    256
+#define PCI_MAX_SLOT   32
+#define PCI_MAX_FUNC   8
+
+static inline void config_select(const pci_device_t *dev, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, PCI_ENABLE | ((uint32_t)dev->bus << 16) |
+         ((uint32_t)dev->slot << 11) | ((uint32_t)dev->func << 8) | (offset & 0xFC));
+}
+
+uint32_t pci_read32(const pci_device_t *dev, uint8_t offset) {
+    config_select(dev, offset);
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_read16(const pci_device_t *dev, uint8_t offset) {
+    config_select(dev, offset);
+    return inw(PCI_CONFIG_DATA + (offset & 2));
+}
+
+uint8_t pci_read8(const pci_device_t *dev, uint8_t offset) {
+    config_select(dev, offset);
+    return inb(PCI_CONFIG_DATA + (offset & 3));
+}
+
+void pci_write32(const pci_device_t *dev, uint8_t offset, uint32_t value) {
+    config_select(dev, offset);
+    outl(PCI_CONFIG_DATA, value);
+}
+
+void pci_write16(const pci_device_t *dev, uint8_t offset, uint16_t value) {
+    config_select(dev, offset);
+    outw(PCI_CONFIG_DATA + (offset & 2), value);
+}
+
+int pci_find_device(uint16_t vendor, uint16_t device, pci_device_t *dev) {
+    pci_device_t probe;
+
+    for (uint32_t bus = 0; bus < PCI_MAX_BUS; bus++) {
+        for (uint32_t slot = 0; slot < PCI_MAX_SLOT; slot++) {
+            probe.bus = bus;
+            probe.slot = slot;
+            probe.func = 0;
+            if (pci_read16(&probe, PCI_VENDOR_ID) == PCI_VENDOR_NONE) {
+                continue;
+            }
+
+            /* Functions 1-7 only exist on multifunction devices */
+            uint32_t funcs = (pci_read8(&probe, PCI_HEADER_TYPE) & PCI_HEADER_MULTIFUNCTION)
+                             ? PCI_MAX_FUNC : 1;
+            for (uint32_t func = 0; func < funcs; func++) {
+                probe.func = func;
+                uint32_t id = pci_read32(&probe, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) == vendor && (id >> 16) == device) {
+                    probe.vendor = vendor;
+                    probe.device = device;
+                    *dev = probe;
+                    return SUCCESS;
+                }
+            }
+        }
+    }
+    return ERROR_IO;
+}
+
+uint32_t pci_bar_address(const pci_device_t *dev, int bar) {
+    uint8_t offset = PCI_BAR0 + bar * 4;
+    uint32_t value = pci_read32(dev, offset);
+
+    if (value & PCI_BAR_IO) {
+        return 0;
+    }
+    if ((value & 0x6) == PCI_BAR_TYPE_64 && pci_read32(dev, offset + 4)) {
+        return 0;
+    }
+    return value & ~0xFu;
+}
+
+void pci_enable_device(const pci_device_t *dev) {
+    uint16_t command = pci_read16(dev, PCI_COMMAND);
+    pci_write16(dev, PCI_COMMAND, command | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+}
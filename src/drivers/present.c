@@ -0,0 +1,225 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "timer.h"
+#include "bga.h"
+#include "gfx.h"
+#include "virtio_gpu.h"
+#include "present.h"
+
+/*
+ * Frame pacing and retrace-synchronized flips
+ *
+ * Flips happen at the start of vertical retrace, so the Y offset changes
+ * while nothing is being scanned out. The retrace bit of input status
+ * register 1 (0x3DA) is only a level. Catching its rising edge means
+ * watching it, but not for a whole frame: the retrace period is measured
+ * from successive edges. The wait halts until one timer tick before the
+ * predicted edge and spins with pause only for that last stretch. Every
+ * wait is bounded, so hardware without a working retrace bit still gets
+ * its flips, counted as vsync timeouts.
+ *
+ * With a target rate, present_frame() also sleeps until half a refresh
+ * before the frame is due. At 35 Hz on a 70 Hz display, every second
+ * retrace is therefore used.
+ *
+ * Under virtio-gpu there is no retrace to wait for: the host shows a
+ * resource whenever it is flushed. A frame is then only paced, and its
+ * damage goes out in one queue notification. The time spent in the flip
+ * or flush is kept per frame, so the two paths can be compared.
+ */
+
+#define VGA_INPUT_STATUS    0x3DA
+#define VGA_STATUS_RETRACE  0x08
+
+#define REFRESH_DEFAULT_US  14286   /* 70 Hz, the VGA text mode rate */
+#define REFRESH_MIN_US      8000
+#define REFRESH_MAX_US      25000
+
+static uint32_t interval_us;
+static uint64_t last_present_us;
+static uint64_t last_retrace_us;
+static uint32_t refresh_us;
+
+static uint32_t frame_times[PRESENT_HISTORY];
+static uint32_t frame_count;
+static uint32_t missed_count;
+static uint32_t timeout_count;
+static uint64_t flip_total_us;
+static uint32_t flip_max_us;
+static gfx_surface_t *gpu_surface;  /* Set on the device; NULL for BGA */
+
+static inline int in_retrace(void) {
+    return (inb(VGA_INPUT_STATUS) & VGA_STATUS_RETRACE) != 0;
+}
+
+static void note_retrace(uint64_t now) {
+    uint64_t delta = now - last_retrace_us;
+    uint32_t estimate = refresh_us ? refresh_us : REFRESH_DEFAULT_US;
+
+    /* Paced callers see every second or third edge; divide those out */
+    uint32_t skipped = (uint32_t)((delta + estimate / 2) / estimate);
+    if (last_retrace_us && skipped >= 1 && skipped <= 4) {
+        uint32_t sample = (uint32_t)(delta / skipped);
+        if (sample >= REFRESH_MIN_US && sample <= REFRESH_MAX_US) {
+            refresh_us = refresh_us ? (refresh_us * 7 + sample) / 8 : sample;
+        }
+    }
+    last_retrace_us = now;
+}
+
+int vga_wait_vblank(uint32_t timeout_us) {
+    uint64_t now = timer_now_us();
+    uint64_t deadline = now + timeout_us;
+    uint32_t period = refresh_us ? refresh_us : REFRESH_DEFAULT_US;
+    int seen_idle = 0;      /* Display seen outside retrace since the last sleep */
+    uint64_t missed = 0;    /* Inside a retrace at this time: its edge is gone */
+
+    /* Only a rising edge counts: a wait that starts or wakes up inside
+     * retrace lets it end, a flip now might land late in it */
+    for (;;) {
+        now = timer_now_us();
+        if (now >= deadline) {
+            return 0;
+        }
+
+        /* Sleep through most of the frame when the next edge is predictable */
+        if (refresh_us && last_retrace_us) {
+            uint64_t next = last_retrace_us + period;
+            while (next + period / 2 < now || next <= missed) {
+                next += period;
+            }
+            if (seen_idle && next > now + 2 * TIMER_TICK_US) {
+                uint64_t wake = next - TIMER_TICK_US;
+                timer_sleep_until(wake < deadline ? wake : deadline);
+                seen_idle = 0;
+                continue;
+            }
+        }
+
+        if (!in_retrace()) {
+            seen_idle = 1;
+        } else if (seen_idle) {
+            note_retrace(timer_now_us());
+            return 1;
+        } else {
+            missed = now;
+        }
+        __asm__ volatile ("pause");
+    }
+}
+
+void present_init(uint32_t target_hz) {
+    interval_us = target_hz ? 1000000 / target_hz : 0;
+    last_present_us = timer_now_us();
+    frame_count = missed_count = timeout_count = 0;
+    flip_total_us = flip_max_us = 0;
+}
+
+int present_set_surface(gfx_surface_t *surface) {
+    if (!surface) {
+        if (gpu_surface) {
+            virtio_gpu_disable();
+        }
+        gpu_surface = NULL;
+        return SUCCESS;
+    }
+    if (!virtio_gpu_present()) {
+        return ERROR_IO;
+    }
+
+    /* Attached once, which damages all of it; frames send only damage */
+    int result = virtio_gpu_set_surface(surface);
+    if (result != SUCCESS) {
+        return result;
+    }
+    gpu_surface = surface;
+    return SUCCESS;
+}
+
+void present_frame(void) {
+    uint32_t period = refresh_us ? refresh_us : REFRESH_DEFAULT_US;
+
+    if (interval_us) {
+        /* Early by half a refresh only when a retrace wait follows */
+        uint32_t slack = gpu_surface ? 0 : period / 2;
+        uint64_t due = last_present_us + interval_us;
+        if (due > slack) {
+            timer_sleep_until(due - slack);
+        }
+    }
+
+    uint64_t start;
+    if (gpu_surface) {
+        start = timer_now_us();
+        if (virtio_gpu_flush(gpu_surface) != SUCCESS && !virtio_gpu_present()) {
+            /* Device gone; the host shows its own display again */
+            gpu_surface = NULL;
+        }
+    } else {
+        /* Bounded by a little over one refresh */
+        if (!vga_wait_vblank(period + period / 4)) {
+            timeout_count++;
+        }
+        start = timer_now_us();
+        bga_flip();
+    }
+
+    uint64_t now = timer_now_us();
+    uint32_t flip_us = (uint32_t)(now - start);
+    flip_total_us += flip_us;
+    if (flip_us > flip_max_us) {
+        flip_max_us = flip_us;
+    }
+    uint32_t frame_us = (uint32_t)(now - last_present_us);
+    last_present_us = now;
+
+    frame_times[frame_count % PRESENT_HISTORY] = frame_us;
+    frame_count++;
+    if (interval_us && frame_us > interval_us + interval_us / 2) {
+        missed_count++;
+    }
+}
+
+void present_get_stats(present_stats_t *stats) {
+    uint32_t sorted[PRESENT_HISTORY];
+    uint32_t n = frame_count < PRESENT_HISTORY ? frame_count : PRESENT_HISTORY;
+    uint64_t sum = 0;
+
+    /* Insertion sort; a few hundred entries, only when asked */
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t v = frame_times[i];
+        uint32_t j = i;
+        while (j && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+        sum += v;
+    }
+
+    stats->frames = frame_count;
+    stats->missed = missed_count;
+    stats->vsync_timeouts = timeout_count;
+    stats->refresh_us = refresh_us;
+    stats->min_us = n ? sorted[0] : 0;
+    stats->max_us = n ? sorted[n - 1] : 0;
+    stats->avg_us = n ? (uint32_t)(sum / n) : 0;
+    stats->p99_us = n ? sorted[(n * 99 - 1) / 100] : 0;
+    stats->flip_avg_us = frame_count ? (uint32_t)(flip_total_us / frame_count) : 0;
+    stats->flip_max_us = flip_max_us;
+    stats->virtio_gpu = gpu_surface != NULL;
+}
+
+void present_print_stats(void) {
+    present_stats_t stats;
+    present_get_stats(&stats);
+
+    kprintf("Frames: %u presented, %u missed, %u vsync timeouts\n",
+            stats.frames, stats.missed, stats.vsync_timeouts);
+    kprintf("  frame time us: min %u avg %u p99 %u max %u, refresh %u\n",
+            stats.min_us, stats.avg_us, stats.p99_us, stats.max_us, stats.refresh_us);
+    kprintf("  %s us per frame: avg %u max %u\n",
+            stats.virtio_gpu ? "virtio-gpu flush" : "BGA flip",
+            stats.flip_avg_us, stats.flip_max_us);
+}
@@ -0,0 +1,274 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "idt.h"
+#include "serial.h"
+
+/*
+ * 16550 UART console on COM1
+ *
+ * Early boot and panic output is polled. Once serial_enable_irq() has run,
+ * writers only append to a lock-free TX ring. The THRE interrupt then
+ * refills the 16-byte FIFO from the ring, so writers never wait for the
+ * line.
+ *
+ * The ring is multi-producer, single-consumer. A producer reserves space by
+ * advancing tx_head with a compare-and-swap, then fills its slots. Each slot
+ * holds the byte plus the lap number of its position. Writing the slot
+ * therefore also publishes it, with no separate commit step. If a producer
+ * is interrupted half-way, a nested producer (an interrupt handler) can
+ * still reserve and fill its own slots. The consumer stops at the first
+ * unpublished slot and continues once the interrupted producer kicks the
+ * transmitter. When the ring is full, the excess is dropped and counted
+ * rather than blocking.
+ *
+ * The consumer side (tx_fill) only ever runs with interrupts disabled, either
+ * in the IRQ handler or in a writer kicking an idle transmitter.
+ */
+
+#define UART_DATA 0
+#define UART_IER  1
+#define UART_IIR  2     /* Read */
+#define UART_FCR  2     /* Write */
+#define UART_LCR  3
+#define UART_MCR  4
+#define UART_LSR  5
+#define UART_MSR  6
+#define UART_SCR  7
+#define UART_DLL  0     /* With LCR.DLAB */
+#define UART_DLM  1
+
+#define LCR_8N1          0x03
+#define LCR_DLAB         0x80
+#define FCR_FIFO_14      0xC7  /* Enable, clear both FIFOs, 14-byte RX trigger */
+#define MCR_DTR_RTS_OUT2 0x0B  /* OUT2 gates the IRQ line on PC UARTs */
+#define MCR_LOOPBACK     0x1E
+#define IER_THRE         0x02
+#define IIR_NO_INTERRUPT 0x01
+#define IIR_ID_MASK      0x0E
+#define IIR_ID_MODEM     0x00
+#define IIR_ID_THRE      0x02
+#define IIR_ID_LINE      0x06
+#define LSR_THRE         0x20
+
+#define UART_FIFO_DEPTH   16
+#define SERIAL_POLL_LIMIT 100000  /* THRE polls before giving up on a byte */
+
+#define TX_MASK           (SERIAL_TX_RING - 1)
+#define TX_LAP(pos)       (((pos) / SERIAL_TX_RING) & 0xFF)
+#define TX_SLOT(pos, c)   ((uint16_t)((TX_LAP(pos) << 8) | (uint8_t)(c)))
+
+static volatile uint16_t tx_ring[SERIAL_TX_RING];
+static volatile uint32_t tx_head;   /* Next position to reserve */
+static volatile uint32_t tx_tail;   /* Next position to send; consumer only */
+static volatile int tx_busy;        /* A THRE interrupt is on its way */
+static uint32_t tx_dropped;
+
+static int serial_ok;
+static volatile int serial_irq_mode;
+
+static inline uint8_t uart_in(uint16_t reg) {
+    return inb(SERIAL_COM1 + reg);
+}
+
+static inline void uart_out(uint16_t reg, uint8_t value) {
+    outb(SERIAL_COM1 + reg, value);
+}
+
+static void poll_putc(char c) {
+    for (uint32_t i = 0; i < SERIAL_POLL_LIMIT && !(uart_in(UART_LSR) & LSR_THRE); i++) {
+        __asm__ volatile ("pause");
+    }
+    uart_out(UART_DATA, (uint8_t)c);
+}
+
+void serial_init(void) {
+    /* A missing UART reads back 0xFF; check the scratch register first */
+    uart_out(UART_SCR, 0x5A);
+    if (uart_in(UART_SCR) != 0x5A) {
+        return;
+    }
+
+    uart_out(UART_IER, 0);
+    uart_out(UART_LCR, LCR_DLAB);
+    uart_out(UART_DLL, (115200 / SERIAL_BAUD) & 0xFF);
+    uart_out(UART_DLM, (115200 / SERIAL_BAUD) >> 8);
+    uart_out(UART_LCR, LCR_8N1);
+    uart_out(UART_FCR, FCR_FIFO_14);
+
+    /* Loopback self-test before trusting the line */
+    uart_out(UART_MCR, MCR_LOOPBACK);
+    uart_out(UART_DATA, 0xAE);
+    if (uart_in(UART_DATA) != 0xAE) {
+        return;
+    }
+    uart_out(UART_MCR, MCR_DTR_RTS_OUT2);
+
+    /* Lap 0xFF marks every slot as not yet written on the first pass */
+    for (uint32_t i = 0; i < SERIAL_TX_RING; i++) {
+        tx_ring[i] = 0xFF00;
+    }
+    serial_ok = 1;
+}
+
+/* Move up to a FIFO's worth of published bytes to the UART; IF must be clear */
+static void tx_fill(void) {
+    if (!(uart_in(UART_LSR) & LSR_THRE)) {
+        /* Still shifting out; the THRE interrupt will call back */
+        tx_busy = 1;
+        return;
+    }
+
+    uint32_t sent = 0;
+    uint32_t tail = tx_tail;
+    while (sent < UART_FIFO_DEPTH) {
+        uint16_t slot = tx_ring[tail & TX_MASK];
+        if ((slot >> 8) != TX_LAP(tail)) {
+            break;
+        }
+        uart_out(UART_DATA, (uint8_t)slot);
+        tail++;
+        sent++;
+    }
+    tx_tail = tail;
+    tx_busy = sent != 0;
+}
+
+static void tx_kick(void) {
+    uint32_t flags = irq_save();
+    if (!tx_busy && serial_irq_mode) {
+        tx_fill();
+    }
+    irq_restore(flags);
+}
+
+static void serial_irq(interrupt_frame_t *frame) {
+    uint8_t iir;
+    (void)frame;
+
+    while (!((iir = uart_in(UART_IIR)) & IIR_NO_INTERRUPT)) {
+        switch (iir & IIR_ID_MASK) {
+        case IIR_ID_THRE:
+            tx_fill();
+            break;
+        case IIR_ID_LINE:
+            uart_in(UART_LSR);
+            break;
+        case IIR_ID_MODEM:
+            uart_in(UART_MSR);
+            break;
+        default:
+            uart_in(UART_DATA);   /* Received data is not used yet */
+            break;
+        }
+    }
+}
+
+void serial_enable_irq(void) {
+    if (!serial_ok) {
+        return;
+    }
+    irq_register(IRQ_COM1, serial_irq);
+    serial_irq_mode = 1;
+    uart_out(UART_IER, IER_THRE);
+}
+
+void serial_set_polled(void) {
+    if (!serial_ok) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    serial_irq_mode = 0;
+    uart_out(UART_IER, 0);
+
+    /* Send whatever was already published, in order */
+    uint32_t tail = tx_tail;
+    while (tail != tx_head) {
+        uint16_t slot = tx_ring[tail & TX_MASK];
+        if ((slot >> 8) != TX_LAP(tail)) {
+            break;
+        }
+        poll_putc((char)slot);
+        tail++;
+    }
+    tx_tail = tail;
+    tx_busy = 0;
+    irq_restore(flags);
+}
+
+/* Reserve up to want slots; returns how many were granted at *start */
+static uint32_t tx_reserve(uint32_t want, uint32_t *start) {
+    uint32_t head, n;
+
+    do {
+        head = tx_head;
+        uint32_t space = SERIAL_TX_RING - (head - tx_tail);
+        n = want < space ? want : space;
+        if (!n) {
+            return 0;
+        }
+    } while (!__sync_bool_compare_and_swap(&tx_head, head, head + n));
+
+    *start = head;
+    return n;
+}
+
+void serial_write(const char *data, size_t size) {
+    if (!serial_ok) {
+        return;
+    }
+
+    if (!serial_irq_mode) {
+        for (size_t i = 0; i < size; i++) {
+            if (data[i] == '\n') {
+                poll_putc('\r');
+            }
+            poll_putc(data[i]);
+        }
+        return;
+    }
+
+    uint32_t want = size;
+    for (size_t i = 0; i < size; i++) {
+        want += data[i] == '\n';
+    }
+
+    uint32_t pos;
+    uint32_t granted = tx_reserve(want, &pos);
+    if (granted < want) {
+        __sync_fetch_and_add(&tx_dropped, want - granted);
+    }
+
+    uint32_t end = pos + granted;
+    for (size_t i = 0; i < size && pos != end; i++) {
+        if (data[i] == '\n') {
+            tx_ring[pos & TX_MASK] = TX_SLOT(pos, '\r');
+            if (++pos == end) {
+                break;
+            }
+        }
+        tx_ring[pos & TX_MASK] = TX_SLOT(pos, data[i]);
+        pos++;
+    }
+
+    tx_kick();
+}
+
+void serial_drain(void) {
+    if (!serial_ok || !serial_irq_mode) {
+        return;     /* Polled writes have already gone out */
+    }
+    /* The THRE interrupt moves the ring; the timer tick bounds each halt */
+    while (tx_tail != tx_head) {
+        __asm__ volatile ("hlt");
+    }
+}
+
+int serial_present(void) {
+    return serial_ok;
+}
+
+uint32_t serial_dropped(void) {
+    return tx_dropped;
+}
@@ -0,0 +1,126 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "cpu.h"
+#include "idt.h"
+#include "log.h"
+#include "timer.h"
+
+/*
+ * 8253/8254 programmable interval timer
+ *
+ * Channel 0 raises IRQ 0 TIMER_HZ times a second. Its only job is to wake a
+ * halted CPU and keep a coarse tick count. Fine time comes from the TSC.
+ * Its rate is measured once at boot against channel 2, which can be gated
+ * and polled through port 0x61 without interrupts.
+ */
+
+#define PIT_CHANNEL0   0x40
+#define PIT_CHANNEL2   0x42
+#define PIT_COMMAND    0x43
+#define PIT_GATE_PORT  0x61
+
+#define PIT_CMD_CH0_RATE    0x34    /* Channel 0, lobyte/hibyte, mode 2 */
+#define PIT_CMD_CH2_ONESHOT 0xB0    /* Channel 2, lobyte/hibyte, mode 0 */
+#define PIT_GATE2           0x01
+#define PIT_SPEAKER         0x02
+#define PIT_OUT2            0x20
+
+#define CALIBRATE_MS        10
+#define CALIBRATE_RUNS      3
+#define CALIBRATE_POLLS     10000000
+
+static volatile uint32_t ticks;
+static uint64_t tsc_boot;
+
+static void timer_irq(interrupt_frame_t *frame) {
+    (void)frame;
+    ticks++;
+}
+
+/* TSC cycles during one CALIBRATE_MS one-shot on channel 2; 0 on failure */
+static uint64_t calibrate_once(void) {
+    uint16_t count = PIT_FREQUENCY / 1000 * CALIBRATE_MS;
+    uint8_t gate = inb(PIT_GATE_PORT) & ~(PIT_SPEAKER | PIT_GATE2);
+
+    outb(PIT_GATE_PORT, gate);
+    outb(PIT_COMMAND, PIT_CMD_CH2_ONESHOT);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+
+    /* Raising the gate starts the count; OUT2 goes high when it expires */
+    outb(PIT_GATE_PORT, gate | PIT_GATE2);
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < CALIBRATE_POLLS; i++) {
+        if (inb(PIT_GATE_PORT) & PIT_OUT2) {
+            uint64_t cycles = rdtsc() - start;
+            outb(PIT_GATE_PORT, gate);
+            return cycles;
+        }
+    }
+    outb(PIT_GATE_PORT, gate);
+    return 0;
+}
+
+static void calibrate_tsc(void) {
+    uint64_t best = 0;
+
+    /* Interruptions only lengthen a run, so the shortest is the truest */
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t cycles = calibrate_once();
+        if (cycles && (!best || cycles < best)) {
+            best = cycles;
+        }
+    }
+    uint32_t count = PIT_FREQUENCY / 1000 * CALIBRATE_MS;
+    cpu_tsc_khz = (uint32_t)(best * PIT_FREQUENCY / ((uint64_t)count * 1000));
+}
+
+void timer_init(void) {
+    if (cpu_has(CPU_FEATURE_TSC)) {
+        uint32_t flags = irq_save();
+        calibrate_tsc();
+        irq_restore(flags);
+        tsc_boot = rdtsc();
+    }
+
+    uint16_t divisor = PIT_FREQUENCY / TIMER_HZ;
+    outb(PIT_COMMAND, PIT_CMD_CH0_RATE);
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+    irq_register(IRQ_TIMER, timer_irq);
+
+    log_info("Timer: PIT at %u Hz, TSC %u.%03u MHz", TIMER_HZ,
+             cpu_tsc_khz / 1000, cpu_tsc_khz % 1000);
+}
+
+uint32_t timer_ticks(void) {
+    return ticks;
+}
+
+uint64_t timer_now_us(void) {
+    if (cpu_tsc_khz) {
+        return (rdtsc() - tsc_boot) * 1000 / cpu_tsc_khz;
+    }
+    return (uint64_t)ticks * TIMER_TICK_US;
+}
+
+void timer_sleep_until(uint64_t deadline_us) {
+    uint32_t eflags;
+    __asm__ volatile ("pushfl; popl %0" : "=r"(eflags));
+    int can_halt = (eflags & 0x200) != 0;
+
+    for (;;) {
+        uint64_t now = timer_now_us();
+        if (now >= deadline_us) {
+            return;
+        }
+        /* A tick arrives within TIMER_TICK_US; halting longer than the
+         * remaining time could overshoot */
+        if (can_halt && deadline_us - now > TIMER_TICK_US) {
+            __asm__ volatile ("hlt");
+        } else {
+            __asm__ volatile ("pause");
+        }
+    }
+}
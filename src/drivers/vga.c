@@ -0,0 +1,341 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "memory.h"
+#include "serial.h"
+#include "fbcon.h"
+
+/*
+ * VGA text console
+ *
+ * Output is rendered into a RAM shadow that keeps VGA_HISTORY_LINES of
+ * scrollback. Shadow line L lives in slot L % VGA_HISTORY_LINES; lines are
+ * numbered from boot and never renumbered. Writes only touch the shadow
+ * and set a per-line dirty bit. terminal_flush() then copies dirty visible
+ * lines into VGA memory, once per terminal_write() rather than once per
+ * character. Everything written is mirrored to the serial console.
+ *
+ * VGA memory at 0xB8000 holds 32KB, or VGA_HW_LINES lines. The shadow is
+ * placed into it starting at line hw_origin. Scrolling only moves the CRTC
+ * start address (registers 0x0C/0x0D) one line further into that window;
+ * nothing is copied. When the window runs out, the origin moves to the
+ * visible top, and the visible lines are copied to VGA line 0 once.
+ * hw_owner[] records which shadow line each VGA line holds. Lines that come
+ * into view after an origin move are therefore copied even when clean.
+ *
+ * The hardware cursor follows the output position. It is updated in
+ * terminal_flush(), so a whole terminal_write() costs at most one cursor
+ * move. The last values written to the CRTC are cached, and only registers
+ * whose value changed are written, each with a single outw of index and
+ * data. The cursor is hidden while the view is scrolled back.
+ *
+ * Once a framebuffer console is attached (drivers/fbcon.c), flushes draw
+ * there instead. Its screen is scrolled by the distance the view moved,
+ * and only the lines that scrolled in, changed, or held the cursor are
+ * drawn again.
+ */
+
+#define VGA_WIDTH          80
+#define VGA_HEIGHT         25
+#define VGA_MEMORY         0xB8000
+#define VGA_HW_LINES       (0x8000 / (VGA_WIDTH * 2))
+#define VGA_HISTORY_LINES  256  /* Power of two */
+
+#define VGA_CRTC_INDEX     0x3D4
+#define VGA_CRTC_DATA      0x3D5
+#define VGA_CRTC_MAX_SCAN    0x09
+#define VGA_CRTC_CURSOR_START 0x0A
+#define VGA_CRTC_CURSOR_END  0x0B
+#define VGA_CRTC_START_HIGH  0x0C
+#define VGA_CRTC_START_LOW   0x0D
+#define VGA_CRTC_CURSOR_HIGH 0x0E
+#define VGA_CRTC_CURSOR_LOW  0x0F
+#define VGA_CURSOR_DISABLE   0x20  /* In CURSOR_START */
+#define VGA_SCANLINE_MASK    0x1F
+
+#define VGA_NO_LINE        0xFFFFFFFF
+
+static uint16_t vga_shadow[VGA_HISTORY_LINES][VGA_WIDTH];
+static uint32_t vga_dirty[VGA_HISTORY_LINES / 32];
+static uint32_t hw_owner[VGA_HW_LINES];
+
+static uint32_t cursor_line;    /* Shadow line being written */
+static uint32_t first_line;     /* Oldest line still in the shadow */
+static uint32_t view_top;       /* Shadow line shown at the top of the screen */
+static uint32_t hw_origin;      /* Shadow line held at VGA line 0 */
+static uint32_t hw_start = VGA_NO_LINE; /* Last CRTC start line written */
+
+static uint8_t cursor_start;    /* Shape: first and last scanline */
+static uint8_t cursor_end;
+static int cursor_enabled = 1;
+static uint32_t hw_cursor = VGA_NO_LINE;        /* Last cursor cell written */
+static uint8_t hw_cursor_start = 0xFF;         /* Last CURSOR_START written */
+
+static int fb_mode;                     /* Flushes go to the framebuffer console */
+static uint32_t fb_top = VGA_NO_LINE;   /* Shadow line at the top of the fb screen */
+static uint32_t fb_cursor = VGA_NO_LINE;        /* Screen row the fb cursor is drawn on */
+
+size_t terminal_row;
+size_t terminal_column;
+uint8_t terminal_color;
+uint16_t* terminal_buffer;
+
+uint8_t vga_entry_color(enum vga_color fg, enum vga_color bg) {
+    return fg | bg << 4;
+}
+
+uint16_t vga_entry(unsigned char uc, uint8_t color) {
+    return (uint16_t) uc | (uint16_t) color << 8;
+}
+
+static inline uint16_t *shadow_line(uint32_t line) {
+    return vga_shadow[line & (VGA_HISTORY_LINES - 1)];
+}
+
+static inline void mark_dirty(uint32_t line) {
+    uint32_t slot = line & (VGA_HISTORY_LINES - 1);
+    vga_dirty[slot / 32] |= 1u << (slot % 32);
+}
+
+static inline int test_and_clear_dirty(uint32_t line) {
+    uint32_t slot = line & (VGA_HISTORY_LINES - 1);
+    uint32_t bit = 1u << (slot % 32);
+    int dirty = (vga_dirty[slot / 32] & bit) != 0;
+    vga_dirty[slot / 32] &= ~bit;
+    return dirty;
+}
+
+static void clear_line(uint32_t line) {
+    uint16_t blank = vga_entry(' ', terminal_color);
+    uint16_t *cells = shadow_line(line);
+    for (size_t x = 0; x < VGA_WIDTH; x++) {
+        cells[x] = blank;
+    }
+    mark_dirty(line);
+}
+
+/* Index and data in one port write; the CRTC latches the index from the low byte */
+static inline void crtc_write(uint8_t index, uint8_t value) {
+    outw(VGA_CRTC_INDEX, (uint16_t)(value << 8) | index);
+}
+
+static inline uint8_t crtc_read(uint8_t index) {
+    outb(VGA_CRTC_INDEX, index);
+    return inb(VGA_CRTC_DATA);
+}
+
+static void crtc_set_start(uint32_t hw_line) {
+    uint16_t offset = (uint16_t)(hw_line * VGA_WIDTH);
+    crtc_write(VGA_CRTC_START_HIGH, offset >> 8);
+    crtc_write(VGA_CRTC_START_LOW, offset & 0xFF);
+}
+
+/* Move the cursor to a VGA memory cell, writing only the bytes that changed */
+static void crtc_set_cursor(uint32_t cell) {
+    if (hw_cursor == VGA_NO_LINE || (hw_cursor >> 8) != (cell >> 8)) {
+        crtc_write(VGA_CRTC_CURSOR_HIGH, (cell >> 8) & 0xFF);
+    }
+    if (hw_cursor == VGA_NO_LINE || (hw_cursor & 0xFF) != (cell & 0xFF)) {
+        crtc_write(VGA_CRTC_CURSOR_LOW, cell & 0xFF);
+    }
+    hw_cursor = cell;
+}
+
+static void crtc_set_cursor_start(uint8_t value) {
+    if (hw_cursor_start != value) {
+        crtc_write(VGA_CRTC_CURSOR_START, value);
+        hw_cursor_start = value;
+    }
+}
+
+static void update_cursor(uint32_t hw_top) {
+    int visible = cursor_enabled && cursor_line - view_top < VGA_HEIGHT;
+
+    if (visible) {
+        crtc_set_cursor((hw_top + cursor_line - view_top) * VGA_WIDTH + terminal_column);
+    }
+    crtc_set_cursor_start(cursor_start | (visible ? 0 : VGA_CURSOR_DISABLE));
+}
+
+static void fb_flush(void) {
+    uint32_t shift = view_top - fb_top;
+    uint32_t fresh = VGA_HEIGHT;        /* Lines from here down scrolled in */
+
+    fbcon_begin();
+    if (fb_top != VGA_NO_LINE && shift < VGA_HEIGHT) {
+        if (shift) {
+            fbcon_scroll(shift);
+            fresh = VGA_HEIGHT - shift;
+        }
+        if (fb_cursor != VGA_NO_LINE) {
+            fb_cursor = fb_cursor >= shift ? fb_cursor - shift : VGA_NO_LINE;
+        }
+    } else {
+        fresh = 0;
+        fb_cursor = VGA_NO_LINE;
+    }
+    fb_top = view_top;
+
+    for (uint32_t i = 0; i < VGA_HEIGHT; i++) {
+        uint32_t line = view_top + i;
+        if (test_and_clear_dirty(line) || i >= fresh || i == fb_cursor) {
+            fbcon_draw_line(i, shadow_line(line));
+        }
+    }
+
+    fb_cursor = VGA_NO_LINE;
+    if (cursor_enabled && cursor_line - view_top < VGA_HEIGHT) {
+        fb_cursor = cursor_line - view_top;
+        fbcon_draw_cursor(fb_cursor, terminal_column,
+                          shadow_line(cursor_line)[terminal_column] >> 8,
+                          cursor_start, cursor_end);
+    }
+    fbcon_end();
+}
+
+/* Copy dirty or misplaced visible lines to VGA memory, then pan to them */
+void terminal_flush(void) {
+    if (fbcon_active() != fb_mode) {
+        fb_mode = fbcon_active();
+        /* Neither screen saw the other's updates; start both from scratch */
+        fb_top = VGA_NO_LINE;
+        for (uint32_t i = 0; i < VGA_HW_LINES; i++) {
+            hw_owner[i] = VGA_NO_LINE;
+        }
+    }
+    if (fb_mode) {
+        fb_flush();
+        return;
+    }
+
+    if (view_top < hw_origin || view_top + VGA_HEIGHT > hw_origin + VGA_HW_LINES) {
+        hw_origin = view_top;
+    }
+
+    uint32_t hw_top = view_top - hw_origin;
+    for (uint32_t i = 0; i < VGA_HEIGHT; i++) {
+        uint32_t line = view_top + i;
+        uint32_t hw_line = hw_top + i;
+        if (test_and_clear_dirty(line) || hw_owner[hw_line] != line) {
+            memcpy(&terminal_buffer[hw_line * VGA_WIDTH], shadow_line(line),
+                   VGA_WIDTH * sizeof(uint16_t));
+            hw_owner[hw_line] = line;
+        }
+    }
+
+    /* Pan after the copy so the new lines never show half-written */
+    if (hw_start != hw_top) {
+        crtc_set_start(hw_top);
+        hw_start = hw_top;
+    }
+    update_cursor(hw_top);
+}
+
+static void terminal_newline(void) {
+    terminal_column = 0;
+    cursor_line++;
+    clear_line(cursor_line);
+
+    if (cursor_line - first_line >= VGA_HISTORY_LINES) {
+        first_line = cursor_line - VGA_HISTORY_LINES + 1;
+    }
+    if (cursor_line >= VGA_HEIGHT) {
+        view_top = cursor_line - VGA_HEIGHT + 1;
+    }
+    terminal_row = cursor_line - view_top;
+}
+
+void terminal_initialize(void) {
+    terminal_row = 0;
+    terminal_column = 0;
+    terminal_color = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    terminal_buffer = (uint16_t*) VGA_MEMORY;
+
+    cursor_line = first_line = view_top = hw_origin = 0;
+    for (uint32_t i = 0; i < VGA_HW_LINES; i++) {
+        hw_owner[i] = VGA_NO_LINE;
+    }
+    for (uint32_t i = 0; i < VGA_HEIGHT; i++) {
+        clear_line(i);
+    }
+
+    /* Underline cursor on the last two scanlines of the current font */
+    uint8_t height = (crtc_read(VGA_CRTC_MAX_SCAN) & VGA_SCANLINE_MASK) + 1;
+    terminal_set_cursor_shape(height - 2, height - 1);
+}
+
+void terminal_setcolor(uint8_t color) {
+    terminal_color = color;
+}
+
+void terminal_putentryat(char c, uint8_t color, size_t x, size_t y) {
+    uint32_t line = view_top + y;
+    shadow_line(line)[x] = vga_entry(c, color);
+    mark_dirty(line);
+}
+
+/* Render one character into the shadow without flushing */
+static void terminal_emit(char c) {
+    /* New output snaps a scrolled-back view to the bottom */
+    if (cursor_line - view_top >= VGA_HEIGHT) {
+        view_top = cursor_line - VGA_HEIGHT + 1;
+    }
+
+    if (c == '\n') {
+        terminal_newline();
+        return;
+    }
+
+    shadow_line(cursor_line)[terminal_column] = vga_entry(c, terminal_color);
+    mark_dirty(cursor_line);
+    if (++terminal_column == VGA_WIDTH) {
+        terminal_newline();
+    }
+}
+
+void terminal_putchar(char c) {
+    serial_write(&c, 1);
+    terminal_emit(c);
+    terminal_flush();
+}
+
+void terminal_write(const char* data, size_t size) {
+    serial_write(data, size);
+    for (size_t i = 0; i < size; i++)
+        terminal_emit(data[i]);
+    terminal_flush();
+}
+
+void terminal_writestring(const char* data) {
+    terminal_write(data, strlen(data));
+}
+
+/* Move the view through the scrollback; negative lines go back in time */
+void terminal_scroll_view(int lines) {
+    uint32_t bottom = cursor_line >= VGA_HEIGHT ? cursor_line - VGA_HEIGHT + 1 : 0;
+    int32_t target = (int32_t)view_top + lines;
+
+    if (target < (int32_t)first_line) {
+        target = first_line;
+    }
+    if (target > (int32_t)bottom) {
+        target = bottom;
+    }
+    view_top = (uint32_t)target;
+    terminal_row = cursor_line - view_top;
+    terminal_flush();
+}
+
+/* Cursor covers scanlines start..end of the character cell */
+void terminal_set_cursor_shape(uint8_t start, uint8_t end) {
+    cursor_start = start & VGA_SCANLINE_MASK;
+    cursor_end = end & VGA_SCANLINE_MASK;
+    crtc_write(VGA_CRTC_CURSOR_END, cursor_end);
+    hw_cursor_start = 0xFF;     /* Rewrite CURSOR_START on the next flush */
+    terminal_flush();
+}
+
+void terminal_show_cursor(int visible) {
+    cursor_enabled = visible;
+    terminal_flush();
+}
@@ -0,0 +1,275 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "memory.h"
+#include "cpu.h"
+#include "pci.h"
+#include "timer.h"
+#include "virtio.h"
+
+/*
+ * Virtio PCI transport
+ *
+ * A modern virtio function describes its register blocks through vendor
+ * capabilities in PCI configuration space. Each gives a BAR, an offset and
+ * a length for the common configuration, the notification area, the ISR
+ * byte or the device-specific configuration. The blocks are mapped
+ * uncached, once.
+ *
+ * Queues are split virtqueues in memory the driver provides. Submission is
+ * separate from notification: a driver queues a whole batch of chains,
+ * publishes the available index once, and writes the doorbell once. Each
+ * doorbell write is a VM exit, so it costs far more than filling a ring slot.
+ */
+
+#define VIRTIO_PCI_CAP_COMMON_CFG   1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG   2
+#define VIRTIO_PCI_CAP_ISR_CFG      3
+#define VIRTIO_PCI_CAP_DEVICE_CFG   4
+
+/* struct virtio_pci_cap, after the ID and next bytes */
+#define VIRTIO_CAP_CFG_TYPE     3
+#define VIRTIO_CAP_BAR          4
+#define VIRTIO_CAP_OFFSET       8
+#define VIRTIO_CAP_LENGTH       12
+#define VIRTIO_CAP_NOTIFY_MULT  16
+
+/* struct virtio_pci_common_cfg */
+#define VIRTIO_COMMON_DFSELECT      0x00
+#define VIRTIO_COMMON_DF            0x04
+#define VIRTIO_COMMON_GFSELECT      0x08
+#define VIRTIO_COMMON_GF            0x0C
+#define VIRTIO_COMMON_STATUS        0x14
+#define VIRTIO_COMMON_Q_SELECT      0x16
+#define VIRTIO_COMMON_Q_SIZE        0x18
+#define VIRTIO_COMMON_Q_ENABLE      0x1C
+#define VIRTIO_COMMON_Q_NOFF        0x1E
+#define VIRTIO_COMMON_Q_DESCLO      0x20
+#define VIRTIO_COMMON_Q_DESCHI      0x24
+#define VIRTIO_COMMON_Q_AVAILLO     0x28
+#define VIRTIO_COMMON_Q_AVAILHI     0x2C
+#define VIRTIO_COMMON_Q_USEDLO      0x30
+#define VIRTIO_COMMON_Q_USEDHI      0x34
+
+#define VIRTIO_RESET_TIMEOUT_US     100000
+
+#define barrier() __asm__ volatile ("" ::: "memory")
+
+static inline uint8_t common_read8(virtio_device_t *dev, uint32_t offset) {
+    return *(volatile uint8_t *)(dev->common + offset);
+}
+
+static inline uint16_t common_read16(virtio_device_t *dev, uint32_t offset) {
+    return *(volatile uint16_t *)(dev->common + offset);
+}
+
+static inline uint32_t common_read32(virtio_device_t *dev, uint32_t offset) {
+    return *(volatile uint32_t *)(dev->common + offset);
+}
+
+static inline void common_write8(virtio_device_t *dev, uint32_t offset, uint8_t value) {
+    *(volatile uint8_t *)(dev->common + offset) = value;
+}
+
+static inline void common_write16(virtio_device_t *dev, uint32_t offset, uint16_t value) {
+    *(volatile uint16_t *)(dev->common + offset) = value;
+}
+
+static inline void common_write32(virtio_device_t *dev, uint32_t offset, uint32_t value) {
+    *(volatile uint32_t *)(dev->common + offset) = value;
+}
+
+static void common_write64(virtio_device_t *dev, uint32_t offset, uint64_t value) {
+    common_write32(dev, offset, (uint32_t)value);
+    common_write32(dev, offset + 4, (uint32_t)(value >> 32));
+}
+
+/* Map the block one capability describes; NULL if its BAR is unusable */
+static volatile uint8_t *map_cap(const pci_device_t *pci, uint8_t cap) {
+    uint32_t bar = pci_bar_address(pci, pci_read8(pci, cap + VIRTIO_CAP_BAR));
+    if (!bar) {
+        return NULL;
+    }
+    uint32_t offset = pci_read32(pci, cap + VIRTIO_CAP_OFFSET);
+    uint32_t length = pci_read32(pci, cap + VIRTIO_CAP_LENGTH);
+    return vmm_map_mmio(bar + offset, length, CACHE_UC);
+}
+
+static void parse_caps(virtio_device_t *dev) {
+    const pci_device_t *pci = &dev->pci;
+    uint8_t cap = pci_read8(pci, PCI_CAPABILITY_LIST) & ~3u;
+
+    /* Capabilities live above the 64-byte header; the bound stops a looping list */
+    for (uint32_t n = 0; cap >= 0x40 && n < 48; n++) {
+        if (pci_read8(pci, cap + PCI_CAP_ID) == PCI_CAP_ID_VENDOR) {
+            /* The first capability of each type is the preferred one */
+            switch (pci_read8(pci, cap + VIRTIO_CAP_CFG_TYPE)) {
+            case VIRTIO_PCI_CAP_COMMON_CFG:
+                if (!dev->common) {
+                    dev->common = map_cap(pci, cap);
+                }
+                break;
+            case VIRTIO_PCI_CAP_NOTIFY_CFG:
+                if (!dev->notify) {
+                    dev->notify = map_cap(pci, cap);
+                    dev->notify_multiplier = pci_read32(pci, cap + VIRTIO_CAP_NOTIFY_MULT);
+                }
+                break;
+            case VIRTIO_PCI_CAP_ISR_CFG:
+                if (!dev->isr) {
+                    dev->isr = map_cap(pci, cap);
+                }
+                break;
+            case VIRTIO_PCI_CAP_DEVICE_CFG:
+                if (!dev->config) {
+                    dev->config = map_cap(pci, cap);
+                }
+                break;
+            }
+        }
+        cap = pci_read8(pci, cap + PCI_CAP_NEXT) & ~3u;
+    }
+}
+
+int virtio_pci_init(virtio_device_t *dev, uint16_t device_id) {
+    memset(dev, 0, sizeof(*dev));
+    if (pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE(device_id), &dev->pci) != SUCCESS) {
+        return ERROR_IO;
+    }
+    if (!(pci_read16(&dev->pci, PCI_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return ERROR_IO;
+    }
+
+    pci_enable_device(&dev->pci);
+    parse_caps(dev);
+    if (!dev->common || !dev->notify) {
+        return ERROR_IO;
+    }
+
+    /* Reset; the device reads back 0 once it is done */
+    common_write8(dev, VIRTIO_COMMON_STATUS, 0);
+    uint64_t deadline = timer_now_us() + VIRTIO_RESET_TIMEOUT_US;
+    while (common_read8(dev, VIRTIO_COMMON_STATUS)) {
+        if (timer_now_us() >= deadline) {
+            return ERROR_IO;
+        }
+        __asm__ volatile ("pause");
+    }
+
+    common_write8(dev, VIRTIO_COMMON_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    common_write8(dev, VIRTIO_COMMON_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    return SUCCESS;
+}
+
+int virtio_negotiate(virtio_device_t *dev, uint64_t features) {
+    uint64_t offered;
+
+    common_write32(dev, VIRTIO_COMMON_DFSELECT, 0);
+    offered = common_read32(dev, VIRTIO_COMMON_DF);
+    common_write32(dev, VIRTIO_COMMON_DFSELECT, 1);
+    offered |= (uint64_t)common_read32(dev, VIRTIO_COMMON_DF) << 32;
+
+    features = (features | (1ULL << VIRTIO_F_VERSION_1)) & offered;
+    if (!(features & (1ULL << VIRTIO_F_VERSION_1))) {
+        virtio_fail(dev);
+        return ERROR_IO;
+    }
+
+    common_write32(dev, VIRTIO_COMMON_GFSELECT, 0);
+    common_write32(dev, VIRTIO_COMMON_GF, (uint32_t)features);
+    common_write32(dev, VIRTIO_COMMON_GFSELECT, 1);
+    common_write32(dev, VIRTIO_COMMON_GF, (uint32_t)(features >> 32));
+
+    uint8_t status = common_read8(dev, VIRTIO_COMMON_STATUS) | VIRTIO_STATUS_FEATURES_OK;
+    common_write8(dev, VIRTIO_COMMON_STATUS, status);
+    if (!(common_read8(dev, VIRTIO_COMMON_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+        virtio_fail(dev);
+        return ERROR_IO;
+    }
+    return SUCCESS;
+}
+
+int virtio_queue_init(virtio_device_t *dev, virtq_t *queue, uint16_t index,
+                      void *memory, uint16_t size) {
+    common_write16(dev, VIRTIO_COMMON_Q_SELECT, index);
+    uint16_t max = common_read16(dev, VIRTIO_COMMON_Q_SIZE);
+    if (!max) {
+        return ERROR_IO;
+    }
+    if (size > max) {
+        size = max;
+    }
+
+    uint8_t *base = memory;
+    memset(queue, 0, sizeof(*queue));
+    queue->index = index;
+    queue->size = size;
+    queue->desc = (virtq_desc_t *)base;
+    queue->avail = (virtq_avail_t *)(base + size * sizeof(virtq_desc_t));
+    queue->used = (virtq_used_t *)(base + VIRTQ_USED_OFFSET(size));
+
+    uint16_t notify_off = common_read16(dev, VIRTIO_COMMON_Q_NOFF);
+    queue->notify = (volatile uint16_t *)(dev->notify + notify_off * dev->notify_multiplier);
+
+    common_write16(dev, VIRTIO_COMMON_Q_SIZE, size);
+    common_write64(dev, VIRTIO_COMMON_Q_DESCLO, virtio_dma_address(queue->desc));
+    common_write64(dev, VIRTIO_COMMON_Q_AVAILLO, virtio_dma_address(queue->avail));
+    common_write64(dev, VIRTIO_COMMON_Q_USEDLO, virtio_dma_address(queue->used));
+    common_write16(dev, VIRTIO_COMMON_Q_ENABLE, 1);
+    return SUCCESS;
+}
+
+void virtio_driver_ok(virtio_device_t *dev) {
+    uint8_t status = common_read8(dev, VIRTIO_COMMON_STATUS);
+    common_write8(dev, VIRTIO_COMMON_STATUS, status | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(virtio_device_t *dev) {
+    uint8_t status = common_read8(dev, VIRTIO_COMMON_STATUS);
+    common_write8(dev, VIRTIO_COMMON_STATUS, status | VIRTIO_STATUS_FAILED);
+}
+
+uint64_t virtio_dma_address(const void *buffer) {
+    /* Without paging, kernel addresses are physical */
+    if (!(read_cr0() & CR0_PG)) {
+        return (uint32_t)buffer;
+    }
+    return vmm_get_physical((uint32_t)buffer);
+}
+
+void virtq_set_desc(virtq_t *queue, uint16_t i, const void *buffer, uint32_t len,
+                    uint16_t flags, uint16_t next) {
+    virtq_desc_t *desc = &queue->desc[i];
+    desc->addr = virtio_dma_address(buffer);
+    desc->len = len;
+    desc->flags = flags;
+    desc->next = next;
+}
+
+void virtq_submit(virtq_t *queue, uint16_t head) {
+    queue->avail->ring[queue->avail_idx & (queue->size - 1)] = head;
+    queue->avail_idx++;
+}
+
+void virtq_kick(virtq_t *queue) {
+    /* Ring entries before the index that publishes them; x86 keeps store order */
+    barrier();
+    queue->avail->idx = queue->avail_idx;
+    barrier();
+    *queue->notify = queue->index;
+}
+
+int virtq_wait_idle(virtq_t *queue, uint32_t timeout_us) {
+    uint64_t deadline = timer_now_us() + timeout_us;
+
+    while (queue->used->idx != queue->avail_idx) {
+        if (timer_now_us() >= deadline) {
+            return ERROR_IO;
+        }
+        __asm__ volatile ("pause");
+    }
+    /* Responses are read only after the index says they are there */
+    barrier();
+    queue->used_idx = queue->avail_idx;
+    return SUCCESS;
+}
@@ -0,0 +1,398 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "memory.h"
+#include "log.h"
+#include "gfx.h"
+#include "virtio.h"
+#include "virtio_gpu.h"
+
+/*
+ * virtio-gpu, 2D only
+ *
+ * The host composites from its own copy of a resource. The guest draws
+ * into ordinary RAM, attached to the resource as its backing store.
+ * TRANSFER_TO_HOST_2D copies a rectangle of that RAM into the resource, and
+ * RESOURCE_FLUSH shows a rectangle of the resource on screen. Nothing is
+ * written through a framebuffer BAR, and the guest never copies pixels:
+ * the host reads the backing pages itself.
+ *
+ * A frame therefore costs one transfer per damaged rectangle, plus a
+ * single flush of their bounding box. gfx damage merging keeps at most
+ * GFX_MAX_DAMAGE rectangles. All commands of a frame go on the control
+ * queue together, and the doorbell is written once. The doorbell write is
+ * the VM exit that dominates the cost. The flush returns once the host has
+ * used every command, after which the pixels may be drawn again.
+ */
+
+#define VIRTIO_GPU_CMD_GET_DISPLAY_INFO         0x0100
+#define VIRTIO_GPU_CMD_RESOURCE_CREATE_2D       0x0101
+#define VIRTIO_GPU_CMD_RESOURCE_UNREF           0x0102
+#define VIRTIO_GPU_CMD_SET_SCANOUT              0x0103
+#define VIRTIO_GPU_CMD_RESOURCE_FLUSH           0x0104
+#define VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D      0x0105
+#define VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING  0x0106
+#define VIRTIO_GPU_RESP_OK_NODATA               0x1100
+#define VIRTIO_GPU_RESP_ERR_UNSPEC              0x1200  /* Errors from here up */
+
+#define VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM    2   /* 0x00RRGGBB in little endian */
+#define VIRTIO_GPU_MAX_SCANOUTS             16
+
+/* Two descriptors per command: request, then response. A frame needs a
+ * transfer per damage rectangle and one flush in a single batch. */
+#define GPU_MAX_BATCH   (VIRTIO_GPU_QUEUE_SIZE / 2)
+#define GPU_FRAME_BATCH (GFX_MAX_DAMAGE + 1)
+
+#if GPU_MAX_BATCH < GPU_FRAME_BATCH
+#error "VIRTIO_GPU_QUEUE_SIZE too small for a frame"
+#endif
+
+typedef struct gpu_hdr {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t fence_id;
+    uint32_t ctx_id;
+    uint32_t padding;
+} __attribute__((packed)) gpu_hdr_t;
+
+typedef struct gpu_rect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} __attribute__((packed)) gpu_rect_t;
+
+typedef struct gpu_display_info {
+    gpu_hdr_t hdr;
+    struct {
+        gpu_rect_t r;
+        uint32_t enabled;
+        uint32_t flags;
+    } __attribute__((packed)) pmodes[VIRTIO_GPU_MAX_SCANOUTS];
+} __attribute__((packed)) gpu_display_info_t;
+
+typedef struct gpu_create_2d {
+    gpu_hdr_t hdr;
+    uint32_t resource_id;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+} __attribute__((packed)) gpu_create_2d_t;
+
+typedef struct gpu_unref {
+    gpu_hdr_t hdr;
+    uint32_t resource_id;
+    uint32_t padding;
+} __attribute__((packed)) gpu_unref_t;
+
+typedef struct gpu_set_scanout {
+    gpu_hdr_t hdr;
+    gpu_rect_t r;
+    uint32_t scanout_id;
+    uint32_t resource_id;
+} __attribute__((packed)) gpu_set_scanout_t;
+
+typedef struct gpu_flush {
+    gpu_hdr_t hdr;
+    gpu_rect_t r;
+    uint32_t resource_id;
+    uint32_t padding;
+} __attribute__((packed)) gpu_flush_t;
+
+typedef struct gpu_transfer_2d {
+    gpu_hdr_t hdr;
+    gpu_rect_t r;
+    uint64_t offset;
+    uint32_t resource_id;
+    uint32_t padding;
+} __attribute__((packed)) gpu_transfer_2d_t;
+
+typedef struct gpu_attach_backing {
+    gpu_hdr_t hdr;
+    uint32_t resource_id;
+    uint32_t nr_entries;
+    struct {
+        uint64_t addr;
+        uint32_t length;
+        uint32_t padding;
+    } __attribute__((packed)) entries[VIRTIO_GPU_MAX_BACKING];
+} __attribute__((packed)) gpu_attach_backing_t;
+
+typedef struct gpu_command {
+    union {
+        gpu_hdr_t hdr;
+        gpu_create_2d_t create;
+        gpu_unref_t unref;
+        gpu_set_scanout_t scanout;
+        gpu_flush_t flush;
+        gpu_transfer_2d_t transfer;
+    } req;
+    gpu_hdr_t resp;
+} gpu_command_t;
+
+static uint8_t queue_memory[VIRTQ_BYTES(VIRTIO_GPU_QUEUE_SIZE)] __attribute__((aligned(16)));
+static gpu_command_t commands[GPU_MAX_BATCH];
+static gpu_hdr_t *responses[GPU_MAX_BATCH];
+static gpu_display_info_t display_info;
+static gpu_attach_backing_t backing;
+
+static virtio_device_t gpu;
+static virtq_t controlq;
+static int gpu_ok;
+static uint32_t batch_count;
+static uint32_t batch_max;          /* Commands that fit the negotiated queue */
+static uint32_t display_width;
+static uint32_t display_height;
+static uint32_t resource_id;        /* Shown on scanout 0; 0 for none */
+static uint32_t resource_next = 1;
+static uint32_t error_count;
+
+/* Queue one request/response pair; sent by batch_run() */
+static void batch_add(const void *req, uint32_t req_len, void *resp, uint32_t resp_len) {
+    uint16_t head = (uint16_t)(batch_count * 2);
+
+    if (batch_count >= batch_max) {
+        panic("virtio-gpu: command batch overflow");
+    }
+
+    ((gpu_hdr_t *)resp)->type = 0;
+    virtq_set_desc(&controlq, head, req, req_len, VIRTQ_DESC_F_NEXT, head + 1);
+    virtq_set_desc(&controlq, head + 1, resp, resp_len, VIRTQ_DESC_F_WRITE, 0);
+    virtq_submit(&controlq, head);
+    responses[batch_count++] = resp;
+}
+
+static gpu_command_t *batch_command(uint32_t type) {
+    gpu_command_t *cmd = &commands[batch_count];
+    memset(&cmd->req, 0, sizeof(cmd->req));
+    cmd->req.hdr.type = type;
+    return cmd;
+}
+
+/* One notification for everything queued, then wait for all of it */
+static int batch_run(void) {
+    int result = SUCCESS;
+
+    if (!batch_count) {
+        return SUCCESS;
+    }
+    virtq_kick(&controlq);
+    if (virtq_wait_idle(&controlq, VIRTIO_GPU_TIMEOUT_US) != SUCCESS) {
+        /* The host may still write the responses; do not reuse the slots */
+        log_err("virtio-gpu: control queue timed out");
+        gpu_ok = 0;
+        batch_count = 0;
+        return ERROR_IO;
+    }
+
+    for (uint32_t i = 0; i < batch_count; i++) {
+        uint32_t type = responses[i]->type;
+        if (type >= VIRTIO_GPU_RESP_ERR_UNSPEC || type == 0) {
+            if (error_count++ < 8) {
+                log_err("virtio-gpu: command failed with %x", type);
+            }
+            result = ERROR_IO;
+        }
+    }
+    batch_count = 0;
+    return result;
+}
+
+static void queue_simple(gpu_command_t *cmd, uint32_t len) {
+    batch_add(&cmd->req, len, &cmd->resp, sizeof(cmd->resp));
+}
+
+int virtio_gpu_init(void) {
+    if (virtio_pci_init(&gpu, VIRTIO_ID_GPU) != SUCCESS) {
+        return ERROR_IO;
+    }
+    /* 2D needs no optional features */
+    if (virtio_negotiate(&gpu, 0) != SUCCESS ||
+        virtio_queue_init(&gpu, &controlq, 0, queue_memory, VIRTIO_GPU_QUEUE_SIZE) != SUCCESS) {
+        virtio_fail(&gpu);
+        return ERROR_IO;
+    }
+    /* The device may have lowered the size; a frame must still fit */
+    batch_max = controlq.size / 2;
+    if (batch_max > GPU_MAX_BATCH) {
+        batch_max = GPU_MAX_BATCH;
+    }
+    if (batch_max < GPU_FRAME_BATCH) {
+        log_err("virtio-gpu: control queue of %u entries is too small", controlq.size);
+        virtio_fail(&gpu);
+        return ERROR_IO;
+    }
+    virtio_driver_ok(&gpu);
+    gpu_ok = 1;
+
+    gpu_command_t *cmd = batch_command(VIRTIO_GPU_CMD_GET_DISPLAY_INFO);
+    batch_add(&cmd->req, sizeof(gpu_hdr_t), &display_info, sizeof(display_info));
+    if (batch_run() != SUCCESS) {
+        gpu_ok = 0;
+        return ERROR_IO;
+    }
+
+    display_width = display_info.pmodes[0].r.width;
+    display_height = display_info.pmodes[0].r.height;
+    if (!display_width || !display_height) {
+        display_width = 1024;
+        display_height = 768;
+    }
+
+    log_info("virtio-gpu: %u:%u.%u, display %ux%u", gpu.pci.bus, gpu.pci.slot, gpu.pci.func,
+             display_width, display_height);
+    return SUCCESS;
+}
+
+int virtio_gpu_present(void) {
+    return gpu_ok;
+}
+
+void virtio_gpu_display_size(uint32_t *width, uint32_t *height) {
+    *width = display_width;
+    *height = display_height;
+}
+
+/* Describe the pixels as runs of physically contiguous memory */
+static int build_backing(const gfx_surface_t *surface) {
+    const uint8_t *p = surface->pixels;
+    const uint8_t *end = p + surface->pitch * surface->height;
+    uint32_t n = 0;
+
+    while (p < end) {
+        uint32_t chunk = PAGE_SIZE - ((uint32_t)p & (PAGE_SIZE - 1));
+        if (chunk > (uint32_t)(end - p)) {
+            chunk = end - p;
+        }
+
+        uint64_t addr = virtio_dma_address(p);
+        if (n && backing.entries[n - 1].addr + backing.entries[n - 1].length == addr) {
+            backing.entries[n - 1].length += chunk;
+        } else {
+            if (n == VIRTIO_GPU_MAX_BACKING) {
+                return ERROR_NOMEM;
+            }
+            backing.entries[n].addr = addr;
+            backing.entries[n].length = chunk;
+            backing.entries[n].padding = 0;
+            n++;
+        }
+        p += chunk;
+    }
+
+    backing.nr_entries = n;
+    return SUCCESS;
+}
+
+static void queue_unref(uint32_t id) {
+    gpu_command_t *cmd = batch_command(VIRTIO_GPU_CMD_RESOURCE_UNREF);
+    cmd->req.unref.resource_id = id;
+    queue_simple(cmd, sizeof(gpu_unref_t));
+}
+
+static void queue_scanout(uint32_t id, uint32_t width, uint32_t height) {
+    gpu_command_t *cmd = batch_command(VIRTIO_GPU_CMD_SET_SCANOUT);
+    cmd->req.scanout.r.width = width;
+    cmd->req.scanout.r.height = height;
+    cmd->req.scanout.scanout_id = 0;
+    cmd->req.scanout.resource_id = id;
+    queue_simple(cmd, sizeof(gpu_set_scanout_t));
+}
+
+int virtio_gpu_set_surface(gfx_surface_t *surface) {
+    if (!gpu_ok) {
+        return ERROR_IO;
+    }
+    if (surface->bpp != 32 || surface->pitch != surface->width * 4 || !surface->width ||
+        !surface->height) {
+        return ERROR_INVALID;
+    }
+
+    uint32_t id = resource_next++;
+    memset(&backing.hdr, 0, sizeof(backing.hdr));
+    backing.hdr.type = VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING;
+    backing.resource_id = id;
+    if (build_backing(surface) != SUCCESS) {
+        return ERROR_NOMEM;
+    }
+
+    gpu_command_t *cmd = batch_command(VIRTIO_GPU_CMD_RESOURCE_CREATE_2D);
+    cmd->req.create.resource_id = id;
+    cmd->req.create.format = VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM;
+    cmd->req.create.width = surface->width;
+    cmd->req.create.height = surface->height;
+    queue_simple(cmd, sizeof(gpu_create_2d_t));
+
+    cmd = batch_command(0);
+    uint32_t len = sizeof(backing) - sizeof(backing.entries) +
+                   backing.nr_entries * sizeof(backing.entries[0]);
+    batch_add(&backing, len, &cmd->resp, sizeof(cmd->resp));
+
+    queue_scanout(id, surface->width, surface->height);
+    if (resource_id) {
+        queue_unref(resource_id);
+    }
+    resource_id = id;
+
+    int result = batch_run();
+    gfx_damage_all(surface);
+    return result;
+}
+
+static void rect_extend(gfx_rect_t *bounds, const gfx_rect_t *r) {
+    int32_t x1 = bounds->x + bounds->w > r->x + r->w ? bounds->x + bounds->w : r->x + r->w;
+    int32_t y1 = bounds->y + bounds->h > r->y + r->h ? bounds->y + bounds->h : r->y + r->h;
+    bounds->x = bounds->x < r->x ? bounds->x : r->x;
+    bounds->y = bounds->y < r->y ? bounds->y : r->y;
+    bounds->w = x1 - bounds->x;
+    bounds->h = y1 - bounds->y;
+}
+
+int virtio_gpu_flush(gfx_surface_t *surface) {
+    gfx_rect_t list[GFX_MAX_DAMAGE];
+
+    if (!gpu_ok || !resource_id) {
+        return ERROR_IO;
+    }
+
+    /* The host resource is the only target, so the surface stands for it */
+    uint32_t count = gfx_take_damage(surface, surface, list);
+    if (!count) {
+        return SUCCESS;
+    }
+
+    gfx_rect_t bounds = list[0];
+    for (uint32_t i = 0; i < count; i++) {
+        gpu_command_t *cmd = batch_command(VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D);
+        cmd->req.transfer.r.x = list[i].x;
+        cmd->req.transfer.r.y = list[i].y;
+        cmd->req.transfer.r.width = list[i].w;
+        cmd->req.transfer.r.height = list[i].h;
+        cmd->req.transfer.offset = (uint64_t)list[i].y * surface->pitch + list[i].x * 4;
+        cmd->req.transfer.resource_id = resource_id;
+        queue_simple(cmd, sizeof(gpu_transfer_2d_t));
+
+        rect_extend(&bounds, &list[i]);
+    }
+
+    /* One flush for the frame; the host repaints only this box */
+    gpu_command_t *cmd = batch_command(VIRTIO_GPU_CMD_RESOURCE_FLUSH);
+    cmd->req.flush.r.x = bounds.x;
+    cmd->req.flush.r.y = bounds.y;
+    cmd->req.flush.r.width = bounds.w;
+    cmd->req.flush.r.height = bounds.h;
+    cmd->req.flush.resource_id = resource_id;
+    queue_simple(cmd, sizeof(gpu_flush_t));
+
+    return batch_run();
+}
+
+void virtio_gpu_disable(void) {
+    if (!gpu_ok || !resource_id) {
+        return;
+    }
+    queue_scanout(0, 0, 0);
+    queue_unref(resource_id);
+    resource_id = 0;
+    batch_run();
+}
@@ -0,0 +1,72 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "memory.h"
+#include "cpu.h"
+#include "alternative.h"
+#include "log.h"
+
+/* Boot-time instruction patching (see alternative.h) */
+
+#define OPCODE_CALL_REL32 0xE8
+#define OPCODE_JMP_REL32  0xE9
+#define OPCODE_NOP        0x90
+
+/* Linker script symbols bounding the patch table */
+extern const alt_instr_t __alt_instructions[];
+extern const alt_instr_t __alt_instructions_end[];
+
+static void alternative_patch(const alt_instr_t *alt) {
+    uint8_t *site = (uint8_t *)alt->site;
+    const uint8_t *replacement = (const uint8_t *)alt->replacement;
+    uint8_t insn[255];
+
+    for (uint32_t i = 0; i < alt->replacement_len; i++) {
+        insn[i] = replacement[i];
+    }
+
+    /* A leading rel32 branch was assembled relative to the replacement */
+    if (alt->replacement_len >= 5 &&
+        (insn[0] == OPCODE_CALL_REL32 || insn[0] == OPCODE_JMP_REL32)) {
+        int32_t rel;
+        memcpy(&rel, &insn[1], sizeof(rel));
+        rel += (int32_t)(alt->replacement - alt->site);
+        memcpy(&insn[1], &rel, sizeof(rel));
+    }
+
+    for (uint32_t i = alt->replacement_len; i < alt->site_len; i++) {
+        insn[i] = OPCODE_NOP;
+    }
+
+    for (uint32_t i = 0; i < alt->site_len; i++) {
+        site[i] = insn[i];
+    }
+}
+
+void alternatives_apply(void) {
+    uint32_t total = 0;
+    uint32_t patched = 0;
+    uint32_t eflags;
+
+    /* Nothing may run a half-written site */
+    __asm__ volatile ("pushfl; popl %0; cli" : "=r"(eflags) : : "memory");
+
+    for (const alt_instr_t *alt = __alt_instructions; alt < __alt_instructions_end; alt++) {
+        total++;
+        if (!cpu_has(alt->feature) || alt->replacement_len > alt->site_len) {
+            continue;
+        }
+        alternative_patch(alt);
+        patched++;
+    }
+
+    /* Serialize so the prefetched old bytes are discarded */
+    if (cpu_has(CPU_FEATURE_CPUID)) {
+        uint32_t a, b, c, d;
+        cpuid(0, 0, &a, &b, &c, &d);
+    }
+
+    __asm__ volatile ("pushl %0; popfl" : : "r"(eflags) : "memory", "cc");
+
+    log_info("Alternatives: %u of %u sites patched", patched, total);
+}
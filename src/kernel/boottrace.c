@@ -0,0 +1,118 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "cpu.h"
+#include "serial.h"
+#include "boottrace.h"
+
+/*
+ * Boot timeline
+ *
+ * kernel_main() marks each phase boundary with boot_trace(). A mark
+ * records the phase name and the TSC, and nothing else. It is cheap
+ * enough to run before the console exists, and converts nothing. The TSC
+ * is only calibrated against the PIT later, in timer_init(). The report
+ * converts every mark to microseconds at the end of boot.
+ *
+ * The first mark also gives the time from CPU reset to kernel_main (the
+ * firmware and boot loader), because the TSC counts from reset. That holds
+ * on a cold boot and in a fresh VM.
+ *
+ * Serial gets the same data one record per line, as "BOOTTRACE" plus
+ * key=value pairs, so CI can grep a boot log and compare releases.
+ */
+
+typedef struct boot_mark {
+    const char *name;
+    uint64_t tsc;
+} boot_mark_t;
+
+static boot_mark_t marks[BOOT_TRACE_MAX + 1];   /* One more for the end mark */
+static uint32_t mark_count;
+static int trace_done;
+static int tsc_ok = -1;                         /* -1: not probed yet */
+
+/* cpu_features is not filled in yet for the first marks */
+static uint64_t trace_tsc(void) {
+    if (tsc_ok < 0) {
+        uint32_t a, b, c, d;
+        tsc_ok = 0;
+        if (cpuid_supported()) {
+            cpuid(0, 0, &a, &b, &c, &d);
+            if (a >= 1) {
+                cpuid(1, 0, &a, &b, &c, &d);
+                tsc_ok = (d >> 4) & 1;
+            }
+        }
+    }
+    return tsc_ok ? rdtsc() : 0;
+}
+
+static void mark(const char *name) {
+    marks[mark_count].name = name;
+    marks[mark_count].tsc = trace_tsc();
+    mark_count++;
+}
+
+void boot_trace(const char *phase) {
+    if (!trace_done && mark_count < BOOT_TRACE_MAX) {
+        mark(phase);
+    }
+}
+
+static uint64_t tsc_to_us(uint64_t tsc) {
+    return tsc * 1000 / cpu_tsc_khz;
+}
+
+/* Serial only: the console already shows the table */
+static void emit(const char *fmt, ...) {
+    char line[96];
+    va_list args;
+
+    va_start(args, fmt);
+    int len = kvsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len > (int)sizeof(line) - 1) {
+        len = sizeof(line) - 1;
+    }
+    serial_write(line, len);
+}
+
+void boot_trace_report(void) {
+    if (!mark_count || trace_done) {
+        return;
+    }
+    mark("end");
+    trace_done = 1;
+
+    if (!tsc_ok || !cpu_tsc_khz) {
+        kprintf("Boot trace: no calibrated TSC\n");
+        serial_drain();
+        emit("BOOTTRACE version=1 tsc_khz=0\n");
+        return;
+    }
+
+    uint32_t phases = mark_count - 1;
+    uint64_t total = marks[phases].tsc - marks[0].tsc;
+    uint32_t total_us = (uint32_t)tsc_to_us(total);
+
+    kprintf("\nBoot timeline (%u phases, %u us):\n", phases, total_us);
+    for (uint32_t i = 0; i < phases; i++) {
+        uint64_t cycles = marks[i + 1].tsc - marks[i].tsc;
+        uint32_t permille = total ? (uint32_t)(cycles * 1000 / total) : 0;
+        kprintf("  %-14s %9u us %3u.%u%%\n", marks[i].name, (uint32_t)tsc_to_us(cycles),
+                permille / 10, permille % 10);
+    }
+    kprintf("  %-14s %9u us\n", "(pre-kernel)", (uint32_t)tsc_to_us(marks[0].tsc));
+
+    /* Start from an empty TX ring so no record is dropped */
+    serial_drain();
+    emit("BOOTTRACE version=1 tsc_khz=%u phases=%u\n", cpu_tsc_khz, phases);
+    for (uint32_t i = 0; i < phases; i++) {
+        emit("BOOTTRACE phase=%s start_us=%u us=%u\n", marks[i].name,
+             (uint32_t)tsc_to_us(marks[i].tsc - marks[0].tsc),
+             (uint32_t)tsc_to_us(marks[i + 1].tsc - marks[i].tsc));
+    }
+    emit("BOOTTRACE total_us=%u preboot_us=%u\n", total_us, (uint32_t)tsc_to_us(marks[0].tsc));
+}
@@ -0,0 +1,138 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "cpu.h"
+
+uint32_t cpu_features = 0;
+char cpu_vendor[13] = "unknown";
+uint32_t cpu_tsc_khz = 0;
+
+/* CPUID exists if EFLAGS.ID (bit 21) can be toggled */
+int cpuid_supported(void) {
+    uint32_t before, after;
+    __asm__ volatile ("pushfl\n\t"
+                      "pushfl\n\t"
+                      "popl %0\n\t"
+                      "movl %0, %1\n\t"
+                      "xorl $0x200000, %1\n\t"
+                      "pushl %1\n\t"
+                      "popfl\n\t"
+                      "pushfl\n\t"
+                      "popl %1\n\t"
+                      "popfl"
+                      : "=&r"(before), "=&r"(after));
+    return ((before ^ after) & 0x200000) != 0;
+}
+
+void cpu_init(void) {
+    uint32_t a, b, c, d;
+    uint32_t max_leaf;
+
+    cpu_features = 0;
+    if (!cpuid_supported()) {
+        return;
+    }
+    cpu_features |= CPU_FEATURE_CPUID | CPU_FEATURE_INVLPG;
+
+    cpuid(0, 0, &max_leaf, &b, &c, &d);
+    *(uint32_t *)&cpu_vendor[0] = b;
+    *(uint32_t *)&cpu_vendor[4] = d;
+    *(uint32_t *)&cpu_vendor[8] = c;
+    cpu_vendor[12] = '\0';
+
+    if (max_leaf >= 1) {
+        cpuid(1, 0, &a, &b, &c, &d);
+        if (d & (1 << 0))  cpu_features |= CPU_FEATURE_FPU;
+        if (d & (1 << 4))  cpu_features |= CPU_FEATURE_TSC;
+        if (d & (1 << 8))  cpu_features |= CPU_FEATURE_CX8;
+        if (d & (1 << 16)) cpu_features |= CPU_FEATURE_PAT;
+        if (d & (1 << 19)) cpu_features |= CPU_FEATURE_CLFLUSH;
+        if (d & (1 << 24)) cpu_features |= CPU_FEATURE_FXSR;
+        if (d & (1 << 25)) cpu_features |= CPU_FEATURE_SSE;
+        if (d & (1 << 26)) cpu_features |= CPU_FEATURE_SSE2;
+        if (c & (1 << 0))  cpu_features |= CPU_FEATURE_SSE3;
+        if (c & (1 << 3))  cpu_features |= CPU_FEATURE_MWAIT;
+    }
+
+    if (max_leaf >= 7) {
+        cpuid(7, 0, &a, &b, &c, &d);
+        if (b & (1 << 9))  cpu_features |= CPU_FEATURE_ERMS;
+        if (d & (1 << 4))  cpu_features |= CPU_FEATURE_FSRM;
+    }
+
+    pat_init();
+}
+
+/*
+ * Page attribute table
+ *
+ * The PWT, PCD and PAT bits of a page table entry form an index into the
+ * eight PAT entries. The power-on layout has no write-combining entry. Entry
+ * 1 (PWT alone) is changed from WT to WC, like Linux does, and entry 7 takes
+ * over WT. Entries 0, 2 and 3 keep their power-on types. A CPU without PAT
+ * still decodes PWT/PCD the old way, so vmm_cache_bits() falls back to UC
+ * for WC there.
+ */
+#define PAT_ENTRY(index, type) ((uint64_t)(type) << ((index) * 8))
+#define PAT_KERNEL_LAYOUT \
+    (PAT_ENTRY(0, PAT_WB) | PAT_ENTRY(1, PAT_WC) | PAT_ENTRY(2, PAT_UC_MINUS) | \
+     PAT_ENTRY(3, PAT_UC) | PAT_ENTRY(4, PAT_WB) | PAT_ENTRY(5, PAT_WP) | \
+     PAT_ENTRY(6, PAT_UC_MINUS) | PAT_ENTRY(7, PAT_WT))
+
+static int pat_active;
+
+int pat_init(void) {
+    if (!cpu_has(CPU_FEATURE_PAT)) {
+        return 0;
+    }
+
+    /* Nothing is mapped with PWT, PCD or PAT set yet, so no stale lines
+     * of the old types can exist and no cache flush is needed */
+    wrmsr(MSR_IA32_PAT, PAT_KERNEL_LAYOUT);
+    pat_active = 1;
+    return 1;
+}
+
+int pat_enabled(void) {
+    return pat_active;
+}
+
+/* Armed by monitor in cpu_idle(); any store to it also ends the mwait */
+static volatile uint32_t cpu_idle_monitor;
+
+void cpu_idle(void) {
+    __asm__ volatile (ALTERNATIVE("hlt",
+                                  "movl %0, %%eax\n\t"
+                                  "xorl %%ecx, %%ecx\n\t"
+                                  "xorl %%edx, %%edx\n\t"
+                                  "monitor\n\t"
+                                  "xorl %%eax, %%eax\n\t"
+                                  "mwait",
+                                  CPU_FEATURE_MWAIT)
+                      : : "i"(&cpu_idle_monitor) : "eax", "ecx", "edx", "memory");
+}
+
+void cpu_print_info(void) {
+    static const struct {
+        uint32_t bit;
+        const char *name;
+    } names[] = {
+        { CPU_FEATURE_FPU, "fpu" },   { CPU_FEATURE_TSC, "tsc" },
+        { CPU_FEATURE_PAT, "pat" },   { CPU_FEATURE_FXSR, "fxsr" },
+        { CPU_FEATURE_SSE, "sse" },   { CPU_FEATURE_SSE2, "sse2" },
+        { CPU_FEATURE_SSE3, "sse3" }, { CPU_FEATURE_MWAIT, "mwait" },
+        { CPU_FEATURE_ERMS, "erms" }, { CPU_FEATURE_FSRM, "fsrm" },
+    };
+
+    terminal_writestring("CPU: ");
+    terminal_writestring(cpu_vendor);
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (cpu_has(names[i].bit)) {
+            terminal_writestring(" ");
+            terminal_writestring(names[i].name);
+        }
+    }
+    terminal_writestring("\nMemory ops: ");
+    terminal_writestring(memops_variant());
+    terminal_writestring("\n");
+}
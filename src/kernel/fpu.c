@@ -0,0 +1,136 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "cpu.h"
+#include "idt.h"
+#include "fpu.h"
+#include "log.h"
+
+/* State of the boot thread until a scheduler calls fpu_switch() */
+static fpu_state_t fpu_boot_state;
+
+static fpu_state_t *fpu_current = &fpu_boot_state;  /* Running thread */
+static fpu_state_t *fpu_owner = NULL;               /* State live in the registers */
+static volatile uint32_t fpu_kernel_depth = 0;
+static int fpu_available = 0;
+
+static inline void clts(void) {
+    __asm__ volatile ("clts");
+}
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void fxsave(fpu_state_t *state) {
+    __asm__ volatile ("fxsave %0" : "=m"(*state));
+}
+
+static inline void fxrstor(fpu_state_t *state) {
+    __asm__ volatile ("fxrstor %0" : : "m"(*state));
+}
+
+static void fpu_load_default(void) {
+    uint32_t mxcsr = FPU_DEFAULT_MXCSR;
+    __asm__ volatile ("fninit");
+    __asm__ volatile ("ldmxcsr %0" : : "m"(mxcsr));
+}
+
+/* #NM: the running thread touched the FPU while CR0.TS was set */
+static void fpu_trap(interrupt_frame_t *frame) {
+    (void)frame;
+
+    clts();
+    if (fpu_owner == fpu_current) {
+        return;
+    }
+
+    if (fpu_owner) {
+        fxsave(fpu_owner);
+        fpu_owner->initialized = 1;
+    }
+
+    if (fpu_current->initialized) {
+        fxrstor(fpu_current);
+    } else {
+        fpu_load_default();
+    }
+    fpu_owner = fpu_current;
+}
+
+static void simd_exception(interrupt_frame_t *frame) {
+    uint32_t mxcsr;
+    __asm__ volatile ("stmxcsr %0" : "=m"(mxcsr));
+
+    kprintf("\nSIMD exception, mxcsr 0x%08x at eip %p\n", mxcsr, (void *)frame->eip);
+    panic("Unmasked SIMD floating point exception");
+}
+
+void fpu_init(void) {
+    if (!cpu_has(CPU_FEATURE_FPU | CPU_FEATURE_FXSR | CPU_FEATURE_SSE)) {
+        log_warn("FPU: no FXSR/SSE support, SIMD disabled");
+        /* Keep alternatives from patching in code that needs SSE state */
+        cpu_features &= ~(CPU_FEATURE_SSE | CPU_FEATURE_SSE2 | CPU_FEATURE_SSE3);
+        return;
+    }
+
+    /* CR0: native FPU (no EM), WAIT honours TS (MP), native #MF errors (NE) */
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+    /* CR4: fxsave/fxrstor and SSE enabled, unmasked SIMD errors raise #XM */
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+    clts();
+    fpu_load_default();
+
+    interrupt_register(VECTOR_DEVICE_NOT_AVAILABLE, fpu_trap);
+    interrupt_register(VECTOR_SIMD_EXCEPTION, simd_exception);
+
+    /* Nobody owns the registers yet; the first use traps */
+    fpu_owner = NULL;
+    stts();
+    fpu_available = 1;
+
+    log_info("FPU/SSE enabled with lazy context switching");
+}
+
+int fpu_enabled(void) {
+    return fpu_available;
+}
+
+void fpu_switch(fpu_state_t *next) {
+    fpu_current = next;
+    if (fpu_owner == next) {
+        clts();
+    } else {
+        stts();
+    }
+}
+
+int kernel_fpu_usable(void) {
+    return fpu_available && fpu_kernel_depth == 0;
+}
+
+void kernel_fpu_begin(void) {
+    uint32_t eflags;
+
+    __asm__ volatile ("pushfl; popl %0; cli" : "=r"(eflags));
+    fpu_kernel_depth++;
+    clts();
+
+    /* Park the owning thread's registers; the kernel gets scratch state */
+    if (fpu_owner) {
+        fxsave(fpu_owner);
+        fpu_owner->initialized = 1;
+        fpu_owner = NULL;
+    }
+
+    if (eflags & 0x200) {
+        __asm__ volatile ("sti");
+    }
+}
+
+void kernel_fpu_end(void) {
+    /* The running thread's next FPU instruction traps and reloads its state */
+    stts();
+    fpu_kernel_depth--;
+}
@@ -0,0 +1,114 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "memory.h"
+#include "idt.h"
+#include "log.h"
+
+/* Interrupt Descriptor Table */
+
+typedef struct idt_entry {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t flags;
+    uint16_t offset_high;
+} __attribute__((packed)) idt_entry_t;
+
+typedef struct idt_pointer {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) idt_pointer_t;
+
+static idt_entry_t idt[IDT_ENTRIES];
+static interrupt_handler_t interrupt_handlers[IDT_ENTRIES];
+static uint16_t kernel_code_selector;
+
+static const char *exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint",
+    "Overflow", "Bound range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS", "Segment not present",
+    "Stack fault", "General protection fault", "Page fault", "Reserved",
+    "x87 floating point", "Alignment check", "Machine check", "SIMD floating point",
+    "Virtualization", "Control protection", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Reserved", "VMM communication", "Security", "Reserved"
+};
+
+void idt_set_gate(uint8_t vector, uint32_t handler, uint8_t flags) {
+    idt[vector].offset_low = handler & 0xFFFF;
+    idt[vector].selector = kernel_code_selector;
+    idt[vector].zero = 0;
+    idt[vector].flags = flags;
+    idt[vector].offset_high = (handler >> 16) & 0xFFFF;
+}
+
+void interrupt_register(uint8_t vector, interrupt_handler_t handler) {
+    interrupt_handlers[vector] = handler;
+}
+
+static void exception_panic(interrupt_frame_t *frame) {
+    kprintf("\nEXCEPTION: %s (vector %u, error 0x%08x)\n  eip %p eflags 0x%08x\n",
+            frame->vector < 32 ? exception_names[frame->vector] : "Unknown",
+            frame->vector, frame->error_code, (void *)frame->eip, frame->eflags);
+    panic("Unhandled exception");
+}
+
+static void page_fault_handler(interrupt_frame_t *frame) {
+    uint32_t addr = get_cr2();
+
+    /* Guard-page hits are reported with the allocation site */
+    kfence_handle_fault(addr, (frame->error_code & 0x2) != 0);
+
+    kprintf("\nPage fault at %p (%s, %s)", (void *)addr,
+            (frame->error_code & 0x2) ? "write" : "read",
+            (frame->error_code & 0x1) ? "protection" : "not present");
+    exception_panic(frame);
+}
+
+void irq_register(uint8_t irq, interrupt_handler_t handler) {
+    interrupt_register(IRQ_BASE + irq, handler);
+    pic_unmask(irq);
+}
+
+void interrupt_dispatch(interrupt_frame_t *frame) {
+    interrupt_handler_t handler = interrupt_handlers[frame->vector];
+
+    if (frame->vector >= IRQ_BASE && frame->vector < IRQ_BASE + IRQ_COUNT) {
+        uint8_t irq = frame->vector - IRQ_BASE;
+        if (pic_is_spurious(irq)) {
+            return;
+        }
+        if (handler) {
+            handler(frame);
+        }
+        pic_eoi(irq);
+    } else if (handler) {
+        handler(frame);
+    } else if (frame->vector < 32) {
+        exception_panic(frame);
+    }
+}
+
+void idt_init(void) {
+    idt_pointer_t idtr;
+
+    /* Gates must use whatever code segment the bootloader left us in */
+    __asm__ volatile ("mov %%cs, %0" : "=r"(kernel_code_selector));
+
+    memset(idt, 0, sizeof(idt));
+    for (uint8_t vector = 0; vector < IRQ_BASE + IRQ_COUNT; vector++) {
+        idt_set_gate(vector, isr_stub_table[vector], IDT_GATE_INTERRUPT);
+    }
+
+    /* IRQs stay masked until a driver registers for them */
+    pic_init();
+
+    interrupt_register(VECTOR_PAGE_FAULT, page_fault_handler);
+
+    idtr.limit = sizeof(idt) - 1;
+    idtr.base = (uint32_t)idt;
+    __asm__ volatile ("lidt %0" : : "m"(idtr));
+
+    log_info("Interrupt descriptor table loaded");
+}
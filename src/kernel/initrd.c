@@ -0,0 +1,173 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "memory.h"
+#include "cpu.h"
+#include "log.h"
+#include "multiboot.h"
+#include "initrd.h"
+
+/*
+ * Read-only filesystem over the initrd boot module
+ *
+ * GRUB loads the image page aligned (MBALIGN, and the Multiboot 2 module
+ * alignment tag), and every file in it starts on a page of its own. A
+ * file's contents are therefore whole frames of the module. initrd_data()
+ * hands out pointers into them, and initrd_map() maps the same frames at
+ * another address. Nothing is read or copied at boot beyond the header
+ * and the entry table, so boot time does not grow with the image.
+ *
+ * The module is never freed and never written.
+ */
+
+static const uint8_t *initrd_base;
+static const initrd_header_t *initrd_header;
+static const initrd_entry_t *initrd_entries;
+static uint32_t initrd_phys;
+
+/* Module command lines are "initrd" or "initrd <anything>" */
+static int named_initrd(const char *cmdline) {
+    return strncmp(cmdline, "initrd", 6) == 0 && (cmdline[6] == '\0' || cmdline[6] == ' ');
+}
+
+static const boot_module_t *find_module(void) {
+    for (uint32_t i = 0; i < boot_info.module_count; i++) {
+        if (named_initrd(boot_info.modules[i].cmdline)) {
+            return &boot_info.modules[i];
+        }
+    }
+    for (uint32_t i = 0; i < boot_info.module_count; i++) {
+        const boot_module_t *mod = &boot_info.modules[i];
+        if (mod->end - mod->start >= sizeof(initrd_header_t) &&
+            ((const initrd_header_t *)mod->start)->magic == INITRD_MAGIC) {
+            return mod;
+        }
+    }
+    return NULL;
+}
+
+static int check_image(const uint8_t *base, uint32_t size) {
+    const initrd_header_t *hdr = (const initrd_header_t *)base;
+
+    if (size < sizeof(*hdr) || hdr->magic != INITRD_MAGIC || hdr->version != INITRD_VERSION ||
+        hdr->total_size > size) {
+        return ERROR_INVALID;
+    }
+    if (hdr->file_count > (hdr->total_size - sizeof(*hdr)) / sizeof(initrd_entry_t)) {
+        return ERROR_INVALID;
+    }
+
+    const initrd_entry_t *entries = (const initrd_entry_t *)(hdr + 1);
+    for (uint32_t i = 0; i < hdr->file_count; i++) {
+        const initrd_entry_t *e = &entries[i];
+        if (e->offset % INITRD_PAGE_SIZE || e->offset > hdr->total_size ||
+            e->size > hdr->total_size - e->offset ||
+            !memchr(e->name, '\0', INITRD_NAME_MAX)) {
+            return ERROR_INVALID;
+        }
+    }
+    return SUCCESS;
+}
+
+int initrd_init(void) {
+    const boot_module_t *mod = find_module();
+    if (!mod) {
+        return ERROR_IO;
+    }
+
+    if (mod->start % INITRD_PAGE_SIZE) {
+        log_warn("initrd: module at %p is not page aligned, not used", (void *)mod->start);
+        return ERROR_INVALID;
+    }
+
+    const uint8_t *base = (const uint8_t *)mod->start;
+    if (check_image(base, mod->end - mod->start) != SUCCESS) {
+        log_err("initrd: module \"%s\" is not a valid image", mod->cmdline);
+        return ERROR_INVALID;
+    }
+
+    initrd_base = base;
+    initrd_phys = mod->start;
+    initrd_header = (const initrd_header_t *)base;
+    initrd_entries = (const initrd_entry_t *)(initrd_header + 1);
+
+    log_info("initrd: %u files, %k at %p", initrd_header->file_count,
+             (size_t)initrd_header->total_size, (void *)mod->start);
+    return SUCCESS;
+}
+
+int initrd_present(void) {
+    return initrd_header != NULL;
+}
+
+uint32_t initrd_count(void) {
+    return initrd_header ? initrd_header->file_count : 0;
+}
+
+const initrd_file_t *initrd_file(uint32_t index) {
+    return index < initrd_count() ? &initrd_entries[index] : NULL;
+}
+
+const initrd_file_t *initrd_open(const char *path) {
+    if (!initrd_header) {
+        return NULL;
+    }
+    while (*path == '/') {
+        path++;
+    }
+
+    /* Entries are sorted by name */
+    uint32_t lo = 0;
+    uint32_t hi = initrd_header->file_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(path, initrd_entries[mid].name);
+        if (!cmp) {
+            return &initrd_entries[mid];
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+const void *initrd_data(const initrd_file_t *file) {
+    return initrd_base + file->offset;
+}
+
+uint32_t initrd_frame(const initrd_file_t *file, uint32_t page) {
+    return initrd_phys + file->offset + page * PAGE_SIZE;
+}
+
+int initrd_map(const initrd_file_t *file, uint32_t virt, uint32_t flags) {
+    if (!(read_cr0() & CR0_PG) || virt % PAGE_SIZE) {
+        return ERROR_INVALID;
+    }
+
+    uint32_t pages = PAGE_ALIGN_UP(file->size) / PAGE_SIZE;
+    flags = (flags & ~PAGE_WRITABLE) | PAGE_PRESENT;
+    for (uint32_t i = 0; i < pages; i++) {
+        vmm_map_page(virt + i * PAGE_SIZE, initrd_frame(file, i), flags);
+    }
+    return SUCCESS;
+}
+
+size_t initrd_read(const initrd_file_t *file, uint32_t offset, void *buf, size_t size) {
+    if (offset >= file->size) {
+        return 0;
+    }
+    if (size > file->size - offset) {
+        size = file->size - offset;
+    }
+    memcpy(buf, initrd_base + file->offset + offset, size);
+    return size;
+}
+
+void initrd_list(void) {
+    for (uint32_t i = 0; i < initrd_count(); i++) {
+        kprintf("  %-40s %k\n", initrd_entries[i].name, (size_t)initrd_entries[i].size);
+    }
+}
@@ -0,0 +1,365 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+
+/*
+ * Formatted output
+ *
+ * Supported conversions:
+ *
+ *   %d %i %u       signed/unsigned decimal
+ *   %x %X %o %b    hex, octal, binary
+ *   %p             pointer as 0x%08x
+ *   %c %s %%       character, string (%.*s and %.Ns limit the length)
+ *   %k             byte count with binary units: "512 B", "4 KiB", "1.5 MiB"
+ *
+ * Flags '-', '0', '+', ' ' and '#', width and precision (both may be '*'),
+ * and the length modifiers hh, h, l, ll and z are accepted.
+ *
+ * The formatter writes into a caller-provided buffer. kprintf() formats
+ * into a KPRINTF_BUFFER buffer on its own stack and passes each completed
+ * line to terminal_write() as one call, so the console flushes once per
+ * line rather than per character. Long lines are sent in buffer-sized
+ * pieces. Nothing is allocated and there is no global lock or state.
+ */
+
+#define KPRINTF_BUFFER 128
+
+#define FLAG_LEFT   0x01
+#define FLAG_ZERO   0x02
+#define FLAG_PLUS   0x04
+#define FLAG_SPACE  0x08
+#define FLAG_ALT    0x10
+#define FLAG_UPPER  0x20
+#define FLAG_POINTER 0x40
+
+typedef struct kprintf_out {
+    char *buf;
+    size_t size;                /* Capacity of buf */
+    size_t pos;                 /* Characters in buf */
+    size_t total;               /* Characters produced so far */
+    void (*flush)(struct kprintf_out *out);  /* NULL: truncate when full */
+} kprintf_out_t;
+
+static inline void out_char(kprintf_out_t *out, char c) {
+    out->total++;
+    if (out->pos < out->size) {
+        out->buf[out->pos++] = c;
+    }
+    if (out->flush && (c == '\n' || out->pos == out->size)) {
+        out->flush(out);
+    }
+}
+
+static void out_repeat(kprintf_out_t *out, char c, int count) {
+    while (count-- > 0) {
+        out_char(out, c);
+    }
+}
+
+static void out_string(kprintf_out_t *out, const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        out_char(out, s[i]);
+    }
+}
+
+/* Writes the digits of value backwards, ending just before end; returns the count */
+static int format_digits(char *end, uint64_t value, unsigned base, int upper) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *p = end;
+
+    if (base == 10) {
+        /* 32-bit division where possible, libgcc 64-bit only when needed */
+        while (value > 0xFFFFFFFFu) {
+            *--p = digits[value % 10];
+            value /= 10;
+        }
+        uint32_t v32 = (uint32_t)value;
+        do {
+            *--p = digits[v32 % 10];
+            v32 /= 10;
+        } while (v32);
+    } else {
+        unsigned shift = base == 16 ? 4 : base == 8 ? 3 : 1;
+        do {
+            *--p = digits[value & (base - 1)];
+            value >>= shift;
+        } while (value);
+    }
+    return (int)(end - p);
+}
+
+static void format_integer(kprintf_out_t *out, uint64_t value, int negative, unsigned base,
+                           int flags, int width, int precision) {
+    char tmp[64];
+    char prefix[3];
+    int prefix_len = 0;
+    int len = 0;
+
+    if (negative) {
+        prefix[prefix_len++] = '-';
+    } else if (flags & FLAG_PLUS) {
+        prefix[prefix_len++] = '+';
+    } else if (flags & FLAG_SPACE) {
+        prefix[prefix_len++] = ' ';
+    }
+    if ((flags & FLAG_ALT) && (value || (flags & FLAG_POINTER))) {
+        if (base == 16) {
+            prefix[prefix_len++] = '0';
+            prefix[prefix_len++] = (flags & FLAG_UPPER) ? 'X' : 'x';
+        } else if (base == 8) {
+            prefix[prefix_len++] = '0';
+        } else if (base == 2) {
+            prefix[prefix_len++] = '0';
+            prefix[prefix_len++] = 'b';
+        }
+    }
+
+    if (!(precision == 0 && value == 0)) {
+        len = format_digits(tmp + sizeof(tmp), value, base, flags & FLAG_UPPER);
+    }
+
+    int zeros = precision > len ? precision - len : 0;
+    if ((flags & FLAG_ZERO) && !(flags & FLAG_LEFT) && precision < 0) {
+        int fill = width - prefix_len - len;
+        zeros = fill > zeros ? fill : zeros;
+    }
+    int pad = width - prefix_len - zeros - len;
+
+    if (!(flags & FLAG_LEFT)) {
+        out_repeat(out, ' ', pad);
+    }
+    out_string(out, prefix, prefix_len);
+    out_repeat(out, '0', zeros);
+    out_string(out, tmp + sizeof(tmp) - len, len);
+    if (flags & FLAG_LEFT) {
+        out_repeat(out, ' ', pad);
+    }
+}
+
+static void format_padded(kprintf_out_t *out, const char *s, size_t len, int flags, int width) {
+    int pad = width - (int)len;
+
+    if (!(flags & FLAG_LEFT)) {
+        out_repeat(out, ' ', pad);
+    }
+    out_string(out, s, len);
+    if (flags & FLAG_LEFT) {
+        out_repeat(out, ' ', pad);
+    }
+}
+
+/* Largest binary unit that keeps the integer part non-zero, one decimal */
+static void format_size(kprintf_out_t *out, uint64_t bytes, int flags, int width) {
+    static const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    char text[24];
+    kprintf_out_t sub = { text, sizeof(text), 0, 0, NULL };
+    unsigned unit = 0;
+
+    while (unit < 4 && bytes >= (1ull << (10 * (unit + 1)))) {
+        unit++;
+    }
+
+    uint64_t whole = bytes >> (10 * unit);
+    uint32_t tenths = 0;
+    if (unit) {
+        uint64_t rest = bytes & ((1ull << (10 * unit)) - 1);
+        tenths = (uint32_t)((rest * 10) >> (10 * unit));
+    }
+
+    format_integer(&sub, whole, 0, 10, 0, 0, -1);
+    if (tenths) {
+        out_char(&sub, '.');
+        out_char(&sub, '0' + tenths);
+    }
+    out_char(&sub, ' ');
+    out_string(&sub, units[unit], strlen(units[unit]));
+    format_padded(out, text, sub.pos, flags, width);
+}
+
+static void kformat(kprintf_out_t *out, const char *fmt, va_list args) {
+    while (*fmt) {
+        if (*fmt != '%') {
+            out_char(out, *fmt++);
+            continue;
+        }
+        fmt++;
+
+        int flags = 0;
+        for (;; fmt++) {
+            if (*fmt == '-') flags |= FLAG_LEFT;
+            else if (*fmt == '0') flags |= FLAG_ZERO;
+            else if (*fmt == '+') flags |= FLAG_PLUS;
+            else if (*fmt == ' ') flags |= FLAG_SPACE;
+            else if (*fmt == '#') flags |= FLAG_ALT;
+            else break;
+        }
+
+        int width = 0;
+        if (*fmt == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                flags |= FLAG_LEFT;
+                width = -width;
+            }
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9') {
+                width = width * 10 + (*fmt++ - '0');
+            }
+        }
+
+        int precision = -1;
+        if (*fmt == '.') {
+            fmt++;
+            precision = 0;
+            if (*fmt == '*') {
+                precision = va_arg(args, int);
+                precision = precision < 0 ? -1 : precision;
+                fmt++;
+            } else {
+                while (*fmt >= '0' && *fmt <= '9') {
+                    precision = precision * 10 + (*fmt++ - '0');
+                }
+            }
+        }
+
+        /* Length: 0 int, 1 long, 2 long long, -1 short, -2 char */
+        int length = 0;
+        if (*fmt == 'h') {
+            length = -1;
+            if (*++fmt == 'h') {
+                length = -2;
+                fmt++;
+            }
+        } else if (*fmt == 'l') {
+            length = 1;
+            if (*++fmt == 'l') {
+                length = 2;
+                fmt++;
+            }
+        } else if (*fmt == 'z') {
+            length = sizeof(size_t) == sizeof(uint64_t) ? 2 : 1;
+            fmt++;
+        }
+
+        char conv = *fmt;
+        if (!conv) {
+            break;
+        }
+        fmt++;
+
+        unsigned base = 10;
+        uint64_t value;
+
+        switch (conv) {
+        case 'd':
+        case 'i': {
+            int64_t v;
+            if (length == 2) v = va_arg(args, long long);
+            else if (length == 1) v = va_arg(args, long);
+            else v = va_arg(args, int);
+            if (length == -1) v = (short)v;
+            if (length == -2) v = (signed char)v;
+            value = v < 0 ? -(uint64_t)v : (uint64_t)v;
+            format_integer(out, value, v < 0, 10, flags, width, precision);
+            continue;
+        }
+        case 'X':
+            flags |= FLAG_UPPER;
+            /* fall through */
+        case 'x':
+            base = 16;
+            break;
+        case 'o':
+            base = 8;
+            break;
+        case 'b':
+            base = 2;
+            break;
+        case 'u':
+            break;
+        case 'p':
+            value = (uintptr_t)va_arg(args, void *);
+            format_integer(out, value, 0, 16, flags | FLAG_ALT | FLAG_POINTER, width,
+                           precision < 0 ? (int)sizeof(void *) * 2 : precision);
+            continue;
+        case 'c': {
+            char c = (char)va_arg(args, int);
+            format_padded(out, &c, 1, flags, width);
+            continue;
+        }
+        case 's': {
+            const char *s = va_arg(args, const char *);
+            if (!s) {
+                s = "(null)";
+            }
+            size_t len = precision >= 0 ? strnlen(s, precision) : strlen(s);
+            format_padded(out, s, len, flags, width);
+            continue;
+        }
+        case 'k':
+            value = length == 2 ? va_arg(args, unsigned long long) : va_arg(args, size_t);
+            format_size(out, value, flags, width);
+            continue;
+        case '%':
+            out_char(out, '%');
+            continue;
+        default:
+            /* Unknown conversion: print it verbatim */
+            out_char(out, '%');
+            out_char(out, conv);
+            continue;
+        }
+
+        if (length == 2) value = va_arg(args, unsigned long long);
+        else if (length == 1) value = va_arg(args, unsigned long);
+        else value = va_arg(args, unsigned int);
+        if (length == -1) value = (uint16_t)value;
+        if (length == -2) value = (uint8_t)value;
+        format_integer(out, value, 0, base, flags, width, precision);
+    }
+}
+
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list args) {
+    kprintf_out_t out = { buf, size ? size - 1 : 0, 0, 0, NULL };
+
+    kformat(&out, fmt, args);
+    if (size) {
+        buf[out.pos] = '\0';
+    }
+    return (int)out.total;
+}
+
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
+
+static void kprintf_flush(kprintf_out_t *out) {
+    terminal_write(out->buf, out->pos);
+    out->pos = 0;
+}
+
+int kvprintf(const char *fmt, va_list args) {
+    char buf[KPRINTF_BUFFER];
+    kprintf_out_t out = { buf, sizeof(buf), 0, 0, kprintf_flush };
+
+    kformat(&out, fmt, args);
+    if (out.pos) {
+        kprintf_flush(&out);
+    }
+    return (int)out.total;
+}
+
+int kprintf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = kvprintf(fmt, args);
+    va_end(args);
+    return len;
+}
@@ -0,0 +1,220 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "memory.h"
+#include "cpu.h"
+#include "log.h"
+
+/*
+ * Kernel log ring (dmesg)
+ *
+ * klog() formats straight into a fixed-size record of a LOG_RECORDS ring.
+ * No lock is taken and no device is touched. The record's sequence number
+ * is reserved with one atomic fetch-and-add on log_head. The writer then
+ * fills the record and publishes it by storing seq + 1 into its header.
+ * While the record is being written the header holds 0. A writer that is
+ * interrupted therefore only holds up its own record, and nested writers
+ * (interrupt handlers) reserve and fill later ones. When the ring wraps,
+ * the oldest records are overwritten.
+ *
+ * log_flush() is the single consumer. It prints committed records to the
+ * console in sequence order and stops at the first one still being
+ * written. Records are copied out and then the header is checked again, so
+ * a record overwritten during the copy is counted as lost, not printed torn.
+ * The idle loop calls log_flush(), which keeps console output out of the
+ * logging caller's path. Before log_set_deferred() (early boot, when
+ * nothing else prints through the log yet), klog() flushes at once so
+ * output keeps its order relative to direct terminal writes.
+ */
+
+#define LOG_MASK        (LOG_RECORDS - 1)
+#define LOG_TEXT_SIZE   (LOG_RECORD_SIZE - 16)
+#define LOG_UNCOMMITTED 0
+
+typedef struct log_record {
+    volatile uint32_t seq;      /* Sequence + 1 once committed */
+    uint8_t level;
+    uint8_t len;
+    uint16_t reserved;
+    uint64_t tsc;
+    char text[LOG_TEXT_SIZE];
+} log_record_t;
+
+/* Records are two cache lines each, so writers never share a line */
+static log_record_t log_ring[LOG_RECORDS] __attribute__((aligned(64)));
+
+static volatile uint32_t log_head;      /* Next sequence to reserve */
+static uint32_t log_tail;               /* Next sequence to print; consumer only */
+static volatile int log_flushing;
+static uint32_t log_lost_count;
+static int log_deferred;
+static int log_console_level = LOG_INFO;
+
+static const char *level_names[] = {
+    "emerg", "alert", "crit", "err", "warn", "notice", "info", "debug"
+};
+
+#define barrier() __asm__ volatile ("" ::: "memory")
+
+uint32_t vklog(int level, const char *fmt, va_list args) {
+    uint32_t seq = __sync_fetch_and_add(&log_head, 1);
+    log_record_t *rec = &log_ring[seq & LOG_MASK];
+
+    rec->seq = LOG_UNCOMMITTED;
+    barrier();
+    rec->tsc = cpu_has(CPU_FEATURE_TSC) ? rdtsc() : 0;
+    rec->level = (uint8_t)(level & 7);
+
+    int len = kvsnprintf(rec->text, LOG_TEXT_SIZE, fmt, args);
+    if (len > LOG_TEXT_SIZE - 1) {
+        len = LOG_TEXT_SIZE - 1;
+    }
+    if (len && rec->text[len - 1] == '\n') {
+        len--;
+    }
+    rec->len = (uint8_t)len;
+
+    /* x86 keeps stores in order; only the compiler must not sink the fill */
+    barrier();
+    rec->seq = seq + 1;
+
+    if (!log_deferred) {
+        log_flush();
+    }
+    return seq;
+}
+
+uint32_t klog(int level, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    uint32_t seq = vklog(level, fmt, args);
+    va_end(args);
+    return seq;
+}
+
+/* Copy out record seq; -1 if not committed, -2 if overwritten by a later lap */
+static int record_copy(uint32_t seq, int *level, uint64_t *tsc, char *buf, size_t size) {
+    log_record_t *rec = &log_ring[seq & LOG_MASK];
+    uint32_t state = rec->seq;
+
+    if (state != seq + 1) {
+        return (int32_t)(state - (seq + 1)) > 0 ? -2 : -1;
+    }
+    barrier();
+
+    size_t len = rec->len < size ? rec->len : size;
+    memcpy(buf, rec->text, len);
+    *level = rec->level;
+    *tsc = rec->tsc;
+
+    barrier();
+    return rec->seq == state ? (int)len : -2;
+}
+
+static void print_lost(uint32_t count) {
+    if (count) {
+        log_lost_count += count;
+        kprintf("log: %u records lost\n", count);
+    }
+}
+
+/* Print up to log_head; force skips records whose writer never finished */
+static void drain(int force) {
+    char line[LOG_TEXT_SIZE + 1];
+    uint32_t lost = 0;
+
+    while (log_tail != log_head) {
+        uint32_t head = log_head;
+        int level;
+        uint64_t tsc;
+        int len = record_copy(log_tail, &level, &tsc, line, LOG_TEXT_SIZE);
+
+        if (len == -1 && !force) {
+            break;
+        }
+        if (len < 0) {
+            /* Overwritten: everything older than one ring behind head is gone */
+            uint32_t oldest = head - LOG_RECORDS;
+            uint32_t next = len == -2 && (int32_t)(oldest - log_tail) > 0 ? oldest : log_tail + 1;
+            lost += next - log_tail;
+            log_tail = next;
+            continue;
+        }
+
+        print_lost(lost);
+        lost = 0;
+        if (level <= log_console_level) {
+            line[len] = '\n';
+            terminal_write(line, len + 1);
+        }
+        log_tail++;
+    }
+
+    print_lost(lost);
+}
+
+void log_flush(void) {
+    do {
+        if (__sync_lock_test_and_set(&log_flushing, 1)) {
+            return;     /* The running flush picks up our records */
+        }
+        drain(0);
+        __sync_lock_release(&log_flushing);
+        /* A record committed after the last check but before the release
+         * would otherwise wait for the next flush */
+    } while (log_tail != log_head && log_ring[log_tail & LOG_MASK].seq == log_tail + 1);
+}
+
+void log_flush_sync(void) {
+    /* Whoever held the consumer is not coming back */
+    log_flushing = 1;
+    drain(1);
+    log_flushing = 0;
+}
+
+void log_set_deferred(void) {
+    log_deferred = 1;
+}
+
+void log_set_console_level(int level) {
+    log_console_level = level;
+}
+
+int log_read(uint32_t seq, int *level, uint64_t *tsc, char *buf, size_t size) {
+    int len = record_copy(seq, level, tsc, buf, size);
+    return len < 0 ? -1 : len;
+}
+
+uint32_t log_next_seq(void) {
+    return log_head;
+}
+
+uint32_t log_lost(void) {
+    return log_lost_count;
+}
+
+void log_dump(void) {
+    char line[LOG_TEXT_SIZE];
+    uint32_t head = log_head;
+    uint32_t seq = head > LOG_RECORDS ? head - LOG_RECORDS : 0;
+
+    kprintf("Kernel log: records %u-%u\n", seq, head ? head - 1 : 0);
+    for (; seq != head; seq++) {
+        int level;
+        uint64_t tsc;
+        int len = log_read(seq, &level, &tsc, line, sizeof(line));
+        if (len < 0) {
+            continue;
+        }
+
+        if (cpu_tsc_khz) {
+            uint64_t us = tsc * 1000 / cpu_tsc_khz;
+            kprintf("%6u [%5u.%06u] %-6s %.*s\n", seq, (uint32_t)(us / 1000000),
+                    (uint32_t)(us % 1000000), level_names[level], len, line);
+        } else {
+            kprintf("%6u [%14llu] %-6s %.*s\n", seq, (unsigned long long)tsc,
+                    level_names[level], len, line);
+        }
+    }
+}
@@ -2,80 +2,69 @@
 #include <stdint.h>
 #include "kernel.h"
 #include "memory.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "idt.h"
+#include "serial.h"
+#include "log.h"
+#include "bga.h"
+#include "timer.h"
+#include "fbcon.h"
+#include "virtio_gpu.h"
+#include "boottrace.h"
+#include "multiboot.h"
+#include "initrd.h"
 
-uint8_t vga_entry_color(enum vga_color fg, enum vga_color bg) {
-    return fg | bg << 4;
-}
-
-uint16_t vga_entry(unsigned char uc, uint8_t color) {
-    return (uint16_t) uc | (uint16_t) color << 8;
-}
-
-size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len])
-        len++;
-    return len;
-}
+void panic(const char* message) {
+    uint32_t trace[8];
+    uint32_t depth;
 
-static const size_t VGA_WIDTH = 80;
-static const size_t VGA_HEIGHT = 25;
+    asm volatile ("cli");
+    /* The TX interrupt will never come again; flush and poll from here on */
+    serial_set_polled();
+    log_flush_sync();
+    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_RED));
+    terminal_writestring("\nKERNEL PANIC: ");
+    terminal_writestring(message);
+    terminal_writestring("\n");
 
-size_t terminal_row;
-size_t terminal_column;
-uint8_t terminal_color;
-uint16_t* terminal_buffer;
+    depth = stack_capture((uint32_t *)__builtin_frame_address(0), trace, 8);
+    stack_print(trace, depth);
 
-void terminal_initialize(void) {
-    terminal_row = 0;
-    terminal_column = 0;
-    terminal_color = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    terminal_buffer = (uint16_t*) 0xB8000;
-    for (size_t y = 0; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t index = y * VGA_WIDTH + x;
-            terminal_buffer[index] = vga_entry(' ', terminal_color);
-        }
+    while (1) {
+        asm volatile ("hlt");
     }
 }
 
-void terminal_setcolor(uint8_t color) {
-    terminal_color = color;
-}
-
-void terminal_putentryat(char c, uint8_t color, size_t x, size_t y) {
-    const size_t index = y * VGA_WIDTH + x;
-    terminal_buffer[index] = vga_entry(c, color);
-}
+/* Show the console on the loader's framebuffer when it set a 32-bit mode */
+static void attach_boot_framebuffer(void) {
+    const boot_framebuffer_t *fb = &boot_info.framebuffer;
 
-void terminal_putchar(char c) {
-    if (c == '\n') {
-        terminal_column = 0;
-        if (++terminal_row == VGA_HEIGHT)
-            terminal_row = 0;
+    if (!fb->addr || (fb->addr >> 32) || fb->type != MULTIBOOT_FRAMEBUFFER_RGB ||
+        fb->bpp != 32 || fb->red_pos != 16 || fb->green_pos != 8 || fb->blue_pos != 0) {
         return;
     }
-    
-    terminal_putentryat(c, terminal_color, terminal_column, terminal_row);
-    if (++terminal_column == VGA_WIDTH) {
-        terminal_column = 0;
-        if (++terminal_row == VGA_HEIGHT)
-            terminal_row = 0;
+    void *pixels = vmm_map_mmio((uint32_t)fb->addr, fb->pitch * fb->height, CACHE_WC);
+    if (pixels) {
+        fbcon_attach(pixels, fb->width, fb->height, fb->pitch, fb->bpp);
     }
 }
 
-void terminal_write(const char* data, size_t size) {
-    for (size_t i = 0; i < size; i++)
-        terminal_putchar(data[i]);
-}
+void kernel_main(uint32_t magic, uint32_t info) {
+    /* Serial first so headless runs capture everything, polled until IRQs are up */
+    boot_trace("serial");
+    serial_init();
 
-void terminal_writestring(const char* data) {
-    terminal_write(data, strlen(data));
-}
+    /* Copy the loader's information before anything can overwrite it */
+    boot_trace("multiboot");
+    multiboot_parse(magic, info);
 
-void kernel_main(void) {
     /* Initialize terminal interface */
+    boot_trace("terminal");
     terminal_initialize();
+    /* The font lives in VGA plane 2; read it before any mode change */
+    fbcon_init();
+    attach_boot_framebuffer();
 
     /* Print welcome message */
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
@@ -85,18 +74,50 @@ void kernel_main(void) {
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
     terminal_writestring("Version: 0.1.0 (Development)\n");
     terminal_writestring("Architecture: x86 (32-bit)\n");
-    terminal_writestring("Build: DEBUG\n\n");
+    terminal_writestring("Build: DEBUG\n");
+    multiboot_print_info();
+    /* Checked before memory_init(): an initrd under the early heap must not be used */
+    initrd_init();
+    
+    /* Exceptions first, so the FPU trap and fault handlers have somewhere to go */
+    boot_trace("idt");
+    idt_init();
+    
+    /* Detect CPU features and patch in the best code paths for them */
+    boot_trace("cpu");
+    cpu_init();
+    fpu_init();
+    alternatives_apply();
+
+    /* Serial output moves to its TX interrupt; start taking IRQs */
+    boot_trace("timer");
+    serial_enable_irq();
+    timer_init();
+    asm volatile ("sti");
+    cpu_print_info();
+
+    /* Find the graphics adapters; the console stays where the loader left it */
+    boot_trace("graphics");
+    bga_init();
+    virtio_gpu_init();
+    terminal_writestring("\n");
     
     /* Initialize memory management system */
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
     terminal_writestring("Initializing Memory Management...\n");
+    boot_trace("memory_init");
     memory_init();
     
     /* Test the memory system */
     terminal_setcolor(vga_entry_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK));
+    boot_trace("memory_test");
     memory_test();
+#ifdef MEMORY_BENCH
+    memory_bench_cacheline();
+#endif
     
     /* Print memory statistics */
+    boot_trace("summary");
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK));
     memory_print_stats();
     
@@ -121,9 +142,15 @@ void kernel_main(void) {
     
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
     terminal_writestring("System running. Memory management operational.\n");
+    boot_trace_report();
     
+    /* From here on log records reach the console from the idle loop */
+    log_set_deferred();
+
     /* Kernel main loop - for now, just halt */
     while (1) {
-        asm volatile ("hlt");
+        log_flush();
+        heap_idle();
+        cpu_idle();
     }
 }
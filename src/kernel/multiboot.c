@@ -0,0 +1,416 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "memory.h"
+#include "log.h"
+#include "multiboot.h"
+
+/*
+ * Multiboot 1 and 2 boot information
+ *
+ * boot.asm carries both headers. GRUB's "multiboot" command uses the first
+ * and "multiboot2" the second, and EAX tells kernel_main which one ran.
+ * Multiboot 1 passes a fixed structure whose flags say which fields are
+ * valid. Multiboot 2 passes a list of 8-byte aligned tags.
+ *
+ * Either way, everything is copied into boot_info at once. The loader
+ * leaves its structures in free memory that the kernel may reuse, and the
+ * early heap may well cover them. Only the ELF symbol table and the modules
+ * stay in place, because GRUB loads them next to the kernel image.
+ */
+
+/* Multiboot 1 info flags */
+#define MB1_INFO_MEMORY      0x00000001
+#define MB1_INFO_CMDLINE     0x00000004
+#define MB1_INFO_MODS        0x00000008
+#define MB1_INFO_ELF_SHDR    0x00000020
+#define MB1_INFO_MEM_MAP     0x00000040
+#define MB1_INFO_LOADER_NAME 0x00000200
+#define MB1_INFO_FRAMEBUFFER 0x00001000
+
+/* Multiboot 2 tag types */
+#define MB2_TAG_END             0
+#define MB2_TAG_CMDLINE         1
+#define MB2_TAG_LOADER_NAME     2
+#define MB2_TAG_MODULE          3
+#define MB2_TAG_BASIC_MEMINFO   4
+#define MB2_TAG_MMAP            6
+#define MB2_TAG_FRAMEBUFFER     8
+#define MB2_TAG_ELF_SECTIONS    9
+#define MB2_TAG_ACPI_OLD        14
+#define MB2_TAG_ACPI_NEW        15
+
+#define ELF_SHT_SYMTAB  2
+#define ELF_STT_FUNC    2
+
+typedef struct mb1_info {
+    uint32_t flags;
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t elf_num;
+    uint32_t elf_size;
+    uint32_t elf_addr;
+    uint32_t elf_shndx;
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+    uint32_t vbe_control_info;
+    uint32_t vbe_mode_info;
+    uint16_t vbe_mode;
+    uint16_t vbe_interface_seg;
+    uint16_t vbe_interface_off;
+    uint16_t vbe_interface_len;
+    uint64_t framebuffer_addr;
+    uint32_t framebuffer_pitch;
+    uint32_t framebuffer_width;
+    uint32_t framebuffer_height;
+    uint8_t framebuffer_bpp;
+    uint8_t framebuffer_type;
+    uint8_t color_info[6];
+} __attribute__((packed)) mb1_info_t;
+
+typedef struct mb1_mmap_entry {
+    uint32_t size;                  /* Of the rest of the entry */
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+} __attribute__((packed)) mb1_mmap_entry_t;
+
+typedef struct mb1_module {
+    uint32_t start;
+    uint32_t end;
+    uint32_t cmdline;
+    uint32_t reserved;
+} __attribute__((packed)) mb1_module_t;
+
+typedef struct mb2_tag {
+    uint32_t type;
+    uint32_t size;                  /* Including this header, not the padding */
+} __attribute__((packed)) mb2_tag_t;
+
+typedef struct mb2_mmap_entry {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t reserved;
+} __attribute__((packed)) mb2_mmap_entry_t;
+
+typedef struct mb2_framebuffer {
+    mb2_tag_t tag;
+    uint64_t addr;
+    uint32_t pitch;
+    uint32_t width;
+    uint32_t height;
+    uint8_t bpp;
+    uint8_t type;
+    uint16_t reserved;
+    uint8_t color_info[6];
+} __attribute__((packed)) mb2_framebuffer_t;
+
+typedef struct elf_shdr {
+    uint32_t name;
+    uint32_t type;
+    uint32_t flags;
+    uint32_t addr;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t link;
+    uint32_t info;
+    uint32_t addralign;
+    uint32_t entsize;
+} elf_shdr_t;
+
+typedef struct elf_sym {
+    uint32_t name;
+    uint32_t value;
+    uint32_t size;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+} elf_sym_t;
+
+boot_info_t boot_info;
+
+static void copy_string(char *dst, size_t size, uint32_t src) {
+    ksnprintf(dst, size, "%s", src ? (const char *)src : "");
+}
+
+static void add_mmap(uint64_t base, uint64_t length, uint32_t type) {
+    if (boot_info.mmap_count < BOOT_MMAP_MAX) {
+        boot_mmap_entry_t *e = &boot_info.mmap[boot_info.mmap_count++];
+        e->base = base;
+        e->length = length;
+        e->type = type;
+    }
+}
+
+static void add_module(uint32_t start, uint32_t end, const char *cmdline) {
+    if (boot_info.module_count < BOOT_MODULES_MAX) {
+        boot_module_t *m = &boot_info.modules[boot_info.module_count++];
+        m->start = start;
+        m->end = end;
+        ksnprintf(m->cmdline, sizeof(m->cmdline), "%s", cmdline);
+    }
+}
+
+static void set_framebuffer(uint64_t addr, uint32_t pitch, uint32_t width, uint32_t height,
+                            uint8_t bpp, uint8_t type, const uint8_t *color_info) {
+    boot_framebuffer_t *fb = &boot_info.framebuffer;
+    fb->addr = addr;
+    fb->pitch = pitch;
+    fb->width = width;
+    fb->height = height;
+    fb->bpp = bpp;
+    fb->type = type;
+    if (type == MULTIBOOT_FRAMEBUFFER_RGB) {
+        fb->red_pos = color_info[0];
+        fb->red_size = color_info[1];
+        fb->green_pos = color_info[2];
+        fb->green_size = color_info[3];
+        fb->blue_pos = color_info[4];
+        fb->blue_size = color_info[5];
+    }
+}
+
+/* Keep .symtab and its string table; memory_init() places the heap above them */
+static void set_elf_sections(const elf_shdr_t *shdrs, uint32_t num, uint32_t entsize) {
+    if (entsize != sizeof(elf_shdr_t)) {
+        return;
+    }
+    for (uint32_t i = 0; i < num; i++) {
+        const elf_shdr_t *sym = &shdrs[i];
+        if (sym->type != ELF_SHT_SYMTAB || sym->link >= num || !sym->addr) {
+            continue;
+        }
+        const elf_shdr_t *str = &shdrs[sym->link];
+        boot_info.symtab = sym->addr;
+        boot_info.symtab_size = sym->size;
+        boot_info.strtab = str->addr;
+        boot_info.strtab_size = str->size;
+        return;
+    }
+}
+
+static void parse_mb1(const mb1_info_t *mbi) {
+    if (mbi->flags & MB1_INFO_MEMORY) {
+        boot_info.mem_lower = mbi->mem_lower;
+        boot_info.mem_upper = mbi->mem_upper;
+    }
+    if (mbi->flags & MB1_INFO_CMDLINE) {
+        copy_string(boot_info.cmdline, sizeof(boot_info.cmdline), mbi->cmdline);
+    }
+    if (mbi->flags & MB1_INFO_LOADER_NAME) {
+        copy_string(boot_info.loader, sizeof(boot_info.loader), mbi->boot_loader_name);
+    }
+    if (mbi->flags & MB1_INFO_MEM_MAP) {
+        uint32_t p = mbi->mmap_addr;
+        while (p < mbi->mmap_addr + mbi->mmap_length) {
+            const mb1_mmap_entry_t *e = (const mb1_mmap_entry_t *)p;
+            add_mmap(e->base, e->length, e->type);
+            p += e->size + sizeof(e->size);
+        }
+    }
+    if (mbi->flags & MB1_INFO_MODS) {
+        const mb1_module_t *mods = (const mb1_module_t *)mbi->mods_addr;
+        for (uint32_t i = 0; i < mbi->mods_count; i++) {
+            add_module(mods[i].start, mods[i].end,
+                       mods[i].cmdline ? (const char *)mods[i].cmdline : "");
+        }
+    }
+    if (mbi->flags & MB1_INFO_ELF_SHDR) {
+        set_elf_sections((const elf_shdr_t *)mbi->elf_addr, mbi->elf_num, mbi->elf_size);
+    }
+    if (mbi->flags & MB1_INFO_FRAMEBUFFER) {
+        set_framebuffer(mbi->framebuffer_addr, mbi->framebuffer_pitch, mbi->framebuffer_width,
+                        mbi->framebuffer_height, mbi->framebuffer_bpp, mbi->framebuffer_type,
+                        mbi->color_info);
+    }
+}
+
+static void parse_mb2_tag(const mb2_tag_t *tag) {
+    const uint8_t *data = (const uint8_t *)(tag + 1);
+    const uint32_t *words = (const uint32_t *)data;
+
+    switch (tag->type) {
+    case MB2_TAG_CMDLINE:
+        copy_string(boot_info.cmdline, sizeof(boot_info.cmdline), (uint32_t)data);
+        break;
+    case MB2_TAG_LOADER_NAME:
+        copy_string(boot_info.loader, sizeof(boot_info.loader), (uint32_t)data);
+        break;
+    case MB2_TAG_MODULE:
+        add_module(words[0], words[1], (const char *)&words[2]);
+        break;
+    case MB2_TAG_BASIC_MEMINFO:
+        boot_info.mem_lower = words[0];
+        boot_info.mem_upper = words[1];
+        break;
+    case MB2_TAG_MMAP: {
+        uint32_t entry_size = words[0];
+        const uint8_t *p = data + 8;            /* After entry_size and entry_version */
+        const uint8_t *end = (const uint8_t *)tag + tag->size;
+        for (; entry_size && p + sizeof(mb2_mmap_entry_t) <= end; p += entry_size) {
+            const mb2_mmap_entry_t *e = (const mb2_mmap_entry_t *)p;
+            add_mmap(e->base, e->length, e->type);
+        }
+        break;
+    }
+    case MB2_TAG_FRAMEBUFFER: {
+        const mb2_framebuffer_t *fb = (const mb2_framebuffer_t *)tag;
+        set_framebuffer(fb->addr, fb->pitch, fb->width, fb->height, fb->bpp, fb->type,
+                        fb->color_info);
+        break;
+    }
+    case MB2_TAG_ELF_SECTIONS:
+        /* GRUB stores num, entsize and shndx as 32-bit words */
+        set_elf_sections((const elf_shdr_t *)&words[3], words[0], words[1]);
+        break;
+    case MB2_TAG_ACPI_OLD:
+    case MB2_TAG_ACPI_NEW: {
+        /* The tag holds a copy of the RSDP; prefer the ACPI 2.0 one */
+        uint32_t size = tag->size - sizeof(*tag);
+        if (size > sizeof(boot_info.rsdp)) {
+            size = sizeof(boot_info.rsdp);
+        }
+        if (tag->type == MB2_TAG_ACPI_NEW || !boot_info.rsdp_size) {
+            memcpy(boot_info.rsdp, data, size);
+            boot_info.rsdp_size = size;
+        }
+        break;
+    }
+    }
+}
+
+static void parse_mb2(uint32_t info) {
+    uint32_t total = *(const uint32_t *)info;
+    uint32_t p = info + 8;
+
+    while (p + sizeof(mb2_tag_t) <= info + total) {
+        const mb2_tag_t *tag = (const mb2_tag_t *)p;
+        if (tag->type == MB2_TAG_END || tag->size < sizeof(*tag)) {
+            break;
+        }
+        parse_mb2_tag(tag);
+        p += (tag->size + 7) & ~7u;
+    }
+}
+
+int multiboot_parse(uint32_t magic, uint32_t info) {
+    memset(&boot_info, 0, sizeof(boot_info));
+
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        boot_info.protocol = 1;
+        parse_mb1((const mb1_info_t *)info);
+    } else if (magic == MULTIBOOT2_BOOTLOADER_MAGIC) {
+        boot_info.protocol = 2;
+        parse_mb2(info);
+    } else {
+        return ERROR_INVALID;
+    }
+    return SUCCESS;
+}
+
+uint64_t multiboot_memory_available(void) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < boot_info.mmap_count; i++) {
+        if (boot_info.mmap[i].type == MULTIBOOT_MEMORY_AVAILABLE) {
+            total += boot_info.mmap[i].length;
+        }
+    }
+    return total;
+}
+
+static uint32_t above(uint32_t addr, uint32_t start, uint32_t end) {
+    return start && end > addr ? end : addr;
+}
+
+uint32_t multiboot_place(uint32_t addr, uint32_t size) {
+    for (uint32_t i = 0; i < boot_info.module_count; i++) {
+        addr = above(addr, boot_info.modules[i].start, boot_info.modules[i].end);
+    }
+    addr = above(addr, boot_info.symtab, boot_info.symtab + boot_info.symtab_size);
+    addr = above(addr, boot_info.strtab, boot_info.strtab + boot_info.strtab_size);
+    addr = PAGE_ALIGN_UP(addr);
+    if (!boot_info.mmap_count) {
+        return addr;
+    }
+
+    /* The map is not sorted; take the lowest fit */
+    uint64_t best = 0;
+    for (uint32_t i = 0; i < boot_info.mmap_count; i++) {
+        const boot_mmap_entry_t *e = &boot_info.mmap[i];
+        if (e->type != MULTIBOOT_MEMORY_AVAILABLE) {
+            continue;
+        }
+        uint64_t start = e->base > addr ? PAGE_ALIGN_UP(e->base) : addr;
+        if (start + size <= e->base + e->length && start + size <= 0x100000000ULL &&
+            (!best || start < best)) {
+            best = start;
+        }
+    }
+    return (uint32_t)best;
+}
+
+void multiboot_print_info(void) {
+    static const char *types[] = { "?", "available", "reserved", "ACPI", "NVS", "bad" };
+
+    if (!boot_info.protocol) {
+        log_warn("Boot: not started by a Multiboot loader");
+        return;
+    }
+
+    log_info("Boot: Multiboot %u from %s, %k available", boot_info.protocol,
+             boot_info.loader[0] ? boot_info.loader : "unknown loader",
+             (size_t)multiboot_memory_available());
+    for (uint32_t i = 0; i < boot_info.mmap_count; i++) {
+        const boot_mmap_entry_t *e = &boot_info.mmap[i];
+        log_debug("  %08x%08x-%08x%08x %s", (uint32_t)(e->base >> 32), (uint32_t)e->base,
+                  (uint32_t)((e->base + e->length - 1) >> 32), (uint32_t)(e->base + e->length - 1),
+                  e->type <= MULTIBOOT_MEMORY_BADRAM ? types[e->type] : types[0]);
+    }
+    if (boot_info.framebuffer.addr) {
+        log_info("Boot: framebuffer %ux%ux%u at %p", boot_info.framebuffer.width,
+                 boot_info.framebuffer.height, boot_info.framebuffer.bpp,
+                 (void *)(uint32_t)boot_info.framebuffer.addr);
+    }
+    for (uint32_t i = 0; i < boot_info.module_count; i++) {
+        log_info("Boot: module %p-%p %s", (void *)boot_info.modules[i].start,
+                 (void *)boot_info.modules[i].end, boot_info.modules[i].cmdline);
+    }
+    if (boot_info.rsdp_size) {
+        log_info("Boot: ACPI %s RSDP from the loader", boot_info.rsdp_size > 20 ? "2.0" : "1.0");
+    }
+    if (boot_info.symtab) {
+        log_info("Boot: %u kernel symbols", boot_info.symtab_size / (uint32_t)sizeof(elf_sym_t));
+    }
+}
+
+const char *multiboot_symbol(uint32_t addr, uint32_t *offset) {
+    const elf_sym_t *syms = (const elf_sym_t *)boot_info.symtab;
+    const elf_sym_t *best = NULL;
+    uint32_t count = boot_info.symtab_size / sizeof(elf_sym_t);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const elf_sym_t *s = &syms[i];
+        if ((s->info & 0xF) != ELF_STT_FUNC || s->value > addr || s->name >= boot_info.strtab_size) {
+            continue;
+        }
+        if (!best || s->value > best->value) {
+            best = s;
+        }
+    }
+    /* Past the end of the nearest function is not inside it */
+    if (!best || (best->size && addr - best->value >= best->size)) {
+        return NULL;
+    }
+    *offset = addr - best->value;
+    return (const char *)boot_info.strtab + best->name;
+}
@@ -0,0 +1,83 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "idt.h"
+
+/* 8259A programmable interrupt controller pair */
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+
+#define PIC_ICW1_INIT 0x11  /* Edge triggered, cascade, ICW4 follows */
+#define PIC_ICW4_8086 0x01
+#define PIC_EOI       0x20
+#define PIC_READ_ISR  0x0B
+
+#define PIC_CASCADE_IRQ 2
+
+/* Port 0x80 is unused; writing to it gives old PICs time between commands */
+static inline void io_wait(void) {
+    outb(0x80, 0);
+}
+
+void pic_init(void) {
+    /* ICW1-ICW4: move IRQs 0-15 to vectors IRQ_BASE..IRQ_BASE+15 */
+    outb(PIC1_COMMAND, PIC_ICW1_INIT);
+    io_wait();
+    outb(PIC2_COMMAND, PIC_ICW1_INIT);
+    io_wait();
+    outb(PIC1_DATA, IRQ_BASE);
+    io_wait();
+    outb(PIC2_DATA, IRQ_BASE + 8);
+    io_wait();
+    outb(PIC1_DATA, 1 << PIC_CASCADE_IRQ);
+    io_wait();
+    outb(PIC2_DATA, PIC_CASCADE_IRQ);
+    io_wait();
+    outb(PIC1_DATA, PIC_ICW4_8086);
+    io_wait();
+    outb(PIC2_DATA, PIC_ICW4_8086);
+    io_wait();
+
+    /* Everything masked except the cascade; drivers unmask their line */
+    outb(PIC1_DATA, (uint8_t)~(1 << PIC_CASCADE_IRQ));
+    outb(PIC2_DATA, 0xFF);
+}
+
+void pic_mask(uint8_t irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+void pic_unmask(uint8_t irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+void pic_eoi(uint8_t irq) {
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+/* IRQ 7/15 fire spuriously when a request goes away before it is acknowledged */
+int pic_is_spurious(uint8_t irq) {
+    if (irq != 7 && irq != 15) {
+        return 0;
+    }
+
+    uint16_t command = irq == 7 ? PIC1_COMMAND : PIC2_COMMAND;
+    outb(command, PIC_READ_ISR);
+    if (inb(command) & 0x80) {
+        return 0;
+    }
+
+    /* The master did see a real cascade interrupt for a spurious slave IRQ */
+    if (irq == 15) {
+        outb(PIC1_COMMAND, PIC_EOI);
+    }
+    return 1;
+}
@@ -0,0 +1,44 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "multiboot.h"
+
+/* Walk the EBP chain starting at `frame`. Requires -fno-omit-frame-pointer;
+ * every frame is bounds checked against the boot stack so a broken chain
+ * just ends the walk. */
+uint32_t stack_capture(uint32_t *frame, uint32_t *trace, uint32_t max) {
+    uint32_t depth = 0;
+
+    while (depth < max) {
+        if ((uint8_t *)frame < stack_bottom || (uint8_t *)(frame + 2) > stack_top) {
+            break;
+        }
+
+        uint32_t ret = frame[1];
+        uint32_t *next = (uint32_t *)frame[0];
+        if (!ret) {
+            break;
+        }
+
+        trace[depth++] = ret;
+
+        if (next <= frame) {
+            break;
+        }
+        frame = next;
+    }
+
+    return depth;
+}
+
+void stack_print(const uint32_t *trace, uint32_t depth) {
+    for (uint32_t i = 0; i < depth; i++) {
+        uint32_t offset;
+        const char *name = multiboot_symbol(trace[i], &offset);
+        if (name) {
+            kprintf("    at %p %s+%x\n", (void *)trace[i], name, offset);
+        } else {
+            kprintf("    at %p\n", (void *)trace[i]);
+        }
+    }
+}
@@ -0,0 +1,588 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "cpu.h"
+#include "fpu.h"
+
+/*
+ * Memory copy and fill primitives
+ *
+ * Three implementations of each primitive are patched in once at boot by
+ * alternatives_apply() from the CPUID feature bits:
+ *
+ *   erms     - rep movsb / rep stosb, fastest on CPUs with Enhanced REP MOVSB
+ *   sse2     - 16-byte aligned stores with unaligned loads, 64 bytes per loop
+ *   integer  - 32-bit words, 16 bytes per loop
+ *
+ * memcpy()/memset() reach the chosen variant through memops_copy/memops_fill,
+ * a single jmp that is rewritten in place, so there is no indirect call.
+ *
+ * All variants align the destination with a short integer head and finish
+ * with an integer tail, so misaligned buffers still take the bulk fast path.
+ * Copies below MEMOPS_SMALL never leave the integer path: the setup cost of
+ * rep or SSE would dominate them. The SSE2 variants also fall back to integer
+ * below MEMOPS_SSE_MIN, where the CR0.TS toggling of kernel_fpu_begin/end
+ * costs more than it saves, and when kernel_fpu_usable() says no.
+ *
+ * memset_nt/memcpy_nt are for page- and framebuffer-sized regions that will
+ * not be read back soon. Their bulk stores are non-temporal (movnti,
+ * movntdq): they go through write-combining buffers straight to memory
+ * instead of evicting useful lines from the cache. Both end with sfence,
+ * because non-temporal stores are weakly ordered. Regions below
+ * MEMOPS_NT_MIN use the cached primitives instead.
+ *
+ * This file must be built with -fno-tree-loop-distribute-patterns so GCC
+ * does not turn the loops below back into calls to memcpy/memset.
+ */
+
+#define MEMOPS_SMALL   64
+#define MEMOPS_SSE_MIN 512
+#define MEMOPS_NT_MIN  256
+
+/* x86 tolerates unaligned word access; may_alias keeps GCC honest */
+typedef uint32_t __attribute__((may_alias, aligned(1))) word_t;
+
+/* Patched trampolines, defined at the end of this file */
+void *memops_copy(void *dest, const void *src, size_t size);
+void *memops_fill(void *ptr, int value, size_t size);
+
+/* Integer building blocks */
+
+static inline void copy_forward(uint8_t *d, const uint8_t *s, size_t size) {
+    /* Align the destination so stores never split */
+    while (size && ((uintptr_t)d & 3)) {
+        *d++ = *s++;
+        size--;
+    }
+
+    while (size >= 16) {
+        uint32_t a = *(const word_t *)(s + 0);
+        uint32_t b = *(const word_t *)(s + 4);
+        uint32_t c = *(const word_t *)(s + 8);
+        uint32_t e = *(const word_t *)(s + 12);
+        *(word_t *)(d + 0) = a;
+        *(word_t *)(d + 4) = b;
+        *(word_t *)(d + 8) = c;
+        *(word_t *)(d + 12) = e;
+        d += 16;
+        s += 16;
+        size -= 16;
+    }
+
+    while (size >= 4) {
+        *(word_t *)d = *(const word_t *)s;
+        d += 4;
+        s += 4;
+        size -= 4;
+    }
+
+    while (size--) {
+        *d++ = *s++;
+    }
+}
+
+/* d and s point one past the end of the regions */
+static inline void copy_backward(uint8_t *d, const uint8_t *s, size_t size) {
+    while (size && ((uintptr_t)d & 3)) {
+        *--d = *--s;
+        size--;
+    }
+
+    while (size >= 16) {
+        d -= 16;
+        s -= 16;
+        size -= 16;
+        uint32_t a = *(const word_t *)(s + 12);
+        uint32_t b = *(const word_t *)(s + 8);
+        uint32_t c = *(const word_t *)(s + 4);
+        uint32_t e = *(const word_t *)(s + 0);
+        *(word_t *)(d + 12) = a;
+        *(word_t *)(d + 8) = b;
+        *(word_t *)(d + 4) = c;
+        *(word_t *)(d + 0) = e;
+    }
+
+    while (size >= 4) {
+        d -= 4;
+        s -= 4;
+        size -= 4;
+        *(word_t *)d = *(const word_t *)s;
+    }
+
+    while (size--) {
+        *--d = *--s;
+    }
+}
+
+static inline void fill_forward(uint8_t *d, uint8_t val, size_t size) {
+    uint32_t val32 = val * 0x01010101u;
+
+    while (size && ((uintptr_t)d & 3)) {
+        *d++ = val;
+        size--;
+    }
+
+    while (size >= 16) {
+        *(word_t *)(d + 0) = val32;
+        *(word_t *)(d + 4) = val32;
+        *(word_t *)(d + 8) = val32;
+        *(word_t *)(d + 12) = val32;
+        d += 16;
+        size -= 16;
+    }
+
+    while (size >= 4) {
+        *(word_t *)d = val32;
+        d += 4;
+        size -= 4;
+    }
+
+    while (size--) {
+        *d++ = val;
+    }
+}
+
+/* Integer variants */
+
+__attribute__((used, noinline))
+static void *memcpy_integer(void *dest, const void *src, size_t size) {
+    copy_forward(dest, src, size);
+    return dest;
+}
+
+__attribute__((used, noinline))
+static void *memset_integer(void *ptr, int value, size_t size) {
+    fill_forward(ptr, (uint8_t)value, size);
+    return ptr;
+}
+
+/* ERMS variants */
+
+__attribute__((used, noinline))
+static void *memcpy_erms(void *dest, const void *src, size_t size) {
+    void *d = dest;
+    __asm__ volatile ("rep movsb"
+                      : "+D"(d), "+S"(src), "+c"(size)
+                      : : "memory");
+    return dest;
+}
+
+__attribute__((used, noinline))
+static void *memset_erms(void *ptr, int value, size_t size) {
+    void *d = ptr;
+    __asm__ volatile ("rep stosb"
+                      : "+D"(d), "+c"(size)
+                      : "a"(value)
+                      : "memory");
+    return ptr;
+}
+
+/* SSE2 variants
+ *
+ * Only the block loops are compiled for SSE2, and they are pure asm called
+ * between kernel_fpu_begin/end. Anything else built with target("sse2") could
+ * be auto-vectorized by GCC and touch xmm registers outside the section. */
+
+__attribute__((target("sse2"), noinline))
+static void sse2_copy_blocks(uint8_t *d, const uint8_t *s, size_t blocks) {
+    __asm__ volatile ("1:\n\t"
+                      "movdqu   (%1), %%xmm0\n\t"
+                      "movdqu 16(%1), %%xmm1\n\t"
+                      "movdqu 32(%1), %%xmm2\n\t"
+                      "movdqu 48(%1), %%xmm3\n\t"
+                      "movdqa %%xmm0,   (%0)\n\t"
+                      "movdqa %%xmm1, 16(%0)\n\t"
+                      "movdqa %%xmm2, 32(%0)\n\t"
+                      "movdqa %%xmm3, 48(%0)\n\t"
+                      "addl $64, %0\n\t"
+                      "addl $64, %1\n\t"
+                      "decl %2\n\t"
+                      "jnz 1b"
+                      : "+r"(d), "+r"(s), "+r"(blocks)
+                      : : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+__attribute__((target("sse2"), noinline))
+static void sse2_fill_blocks(uint8_t *d, uint32_t val32, size_t blocks) {
+    __asm__ volatile ("movd %2, %%xmm0\n\t"
+                      "pshufd $0, %%xmm0, %%xmm0\n"
+                      "1:\n\t"
+                      "movdqa %%xmm0,   (%0)\n\t"
+                      "movdqa %%xmm0, 16(%0)\n\t"
+                      "movdqa %%xmm0, 32(%0)\n\t"
+                      "movdqa %%xmm0, 48(%0)\n\t"
+                      "addl $64, %0\n\t"
+                      "decl %1\n\t"
+                      "jnz 1b"
+                      : "+r"(d), "+r"(blocks)
+                      : "r"(val32)
+                      : "memory", "cc", "xmm0");
+}
+
+__attribute__((used, noinline))
+static void *memcpy_sse2(void *dest, const void *src, size_t size) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    size_t head = (-(uintptr_t)d) & 15;
+
+    if (size < MEMOPS_SSE_MIN || !kernel_fpu_usable()) {
+        copy_forward(d, s, size);
+        return dest;
+    }
+
+    copy_forward(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    kernel_fpu_begin();
+    sse2_copy_blocks(d, s, size / 64);
+    kernel_fpu_end();
+
+    d += size & ~63;
+    s += size & ~63;
+    copy_forward(d, s, size & 63);
+    return dest;
+}
+
+__attribute__((used, noinline))
+static void *memset_sse2(void *ptr, int value, size_t size) {
+    uint8_t *d = ptr;
+    size_t head = (-(uintptr_t)d) & 15;
+
+    if (size < MEMOPS_SSE_MIN || !kernel_fpu_usable()) {
+        fill_forward(d, (uint8_t)value, size);
+        return ptr;
+    }
+
+    fill_forward(d, (uint8_t)value, head);
+    d += head;
+    size -= head;
+
+    kernel_fpu_begin();
+    sse2_fill_blocks(d, (uint8_t)value * 0x01010101u, size / 64);
+    kernel_fpu_end();
+
+    fill_forward(d + (size & ~63), (uint8_t)value, size & 63);
+    return ptr;
+}
+
+/* Non-temporal variants
+ *
+ * movnti needs SSE2 but no SSE state, so it is usable everywhere SSE2 is
+ * present. movntdq does 16 bytes per store and needs a kernel FPU section. */
+
+static inline void sfence(void) {
+    __asm__ volatile ("sfence" : : : "memory");
+}
+
+/* d must be 4-byte aligned */
+static inline void fill_nt_words(uint8_t *d, uint32_t val32, size_t words) {
+    while (words >= 4) {
+        __asm__ volatile ("movnti %1,   (%0)\n\t"
+                          "movnti %1,  4(%0)\n\t"
+                          "movnti %1,  8(%0)\n\t"
+                          "movnti %1, 12(%0)"
+                          : : "r"(d), "r"(val32) : "memory");
+        d += 16;
+        words -= 4;
+    }
+    while (words--) {
+        __asm__ volatile ("movnti %1, (%0)" : : "r"(d), "r"(val32) : "memory");
+        d += 4;
+    }
+}
+
+static inline void copy_nt_words(uint8_t *d, const uint8_t *s, size_t words) {
+    while (words--) {
+        uint32_t v = *(const word_t *)s;
+        __asm__ volatile ("movnti %1, (%0)" : : "r"(d), "r"(v) : "memory");
+        d += 4;
+        s += 4;
+    }
+}
+
+__attribute__((target("sse2"), noinline))
+static void sse2_copy_blocks_nt(uint8_t *d, const uint8_t *s, size_t blocks) {
+    __asm__ volatile ("1:\n\t"
+                      "movdqu   (%1), %%xmm0\n\t"
+                      "movdqu 16(%1), %%xmm1\n\t"
+                      "movdqu 32(%1), %%xmm2\n\t"
+                      "movdqu 48(%1), %%xmm3\n\t"
+                      "movntdq %%xmm0,   (%0)\n\t"
+                      "movntdq %%xmm1, 16(%0)\n\t"
+                      "movntdq %%xmm2, 32(%0)\n\t"
+                      "movntdq %%xmm3, 48(%0)\n\t"
+                      "addl $64, %0\n\t"
+                      "addl $64, %1\n\t"
+                      "decl %2\n\t"
+                      "jnz 1b"
+                      : "+r"(d), "+r"(s), "+r"(blocks)
+                      : : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+/* Fill with a repeating 32-bit pattern; the head keeps the pattern phase */
+static void fill_nt(uint8_t *d, uint32_t val32, size_t size) {
+    size_t head = (-(uintptr_t)d) & 3;
+
+    for (size_t i = 0; i < head; i++) {
+        d[i] = (uint8_t)(val32 >> (i * 8));
+    }
+    val32 = head ? (val32 >> (head * 8)) | (val32 << ((4 - head) * 8)) : val32;
+    d += head;
+    size -= head;
+
+    fill_nt_words(d, val32, size / 4);
+    d += size & ~3;
+    for (size_t i = 0; i < (size & 3); i++) {
+        d[i] = (uint8_t)(val32 >> (i * 8));
+    }
+    sfence();
+}
+
+void *memset_nt(void *ptr, int value, size_t size) {
+    if (size < MEMOPS_NT_MIN || !cpu_has(CPU_FEATURE_SSE2)) {
+        return memset(ptr, value, size);
+    }
+    fill_nt(ptr, (uint8_t)value * 0x01010101u, size);
+    return ptr;
+}
+
+void *memcpy_nt(void *dest, const void *src, size_t size) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (size < MEMOPS_NT_MIN || !cpu_has(CPU_FEATURE_SSE2)) {
+        return memcpy(dest, src, size);
+    }
+
+    size_t head = (-(uintptr_t)d) & 15;
+    copy_forward(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    if (kernel_fpu_usable() && (read_cr4() & CR4_OSFXSR)) {
+        kernel_fpu_begin();
+        sse2_copy_blocks_nt(d, s, size / 64);
+        kernel_fpu_end();
+        d += size & ~63;
+        s += size & ~63;
+        size &= 63;
+    }
+
+    copy_nt_words(d, s, size / 4);
+    copy_forward(d + (size & ~3), s + (size & ~3), size & 3);
+    sfence();
+    return dest;
+}
+
+/* Dispatch */
+
+/* Later entries win: erms over sse2 over integer. fpu_init() clears the SSE
+ * bits when it cannot enable SSE state, so sse2 is only patched in when the
+ * registers are usable. */
+__asm__ (".pushsection .text\n"
+         ".globl memops_copy\n"
+         "memops_copy:\n\t"
+         ALTERNATIVE_2("jmp memcpy_integer",
+                       "jmp memcpy_sse2", CPU_FEATURE_SSE2,
+                       "jmp memcpy_erms", CPU_FEATURE_ERMS)
+         ".globl memops_fill\n"
+         "memops_fill:\n\t"
+         ALTERNATIVE_2("jmp memset_integer",
+                       "jmp memset_sse2", CPU_FEATURE_SSE2,
+                       "jmp memset_erms", CPU_FEATURE_ERMS)
+         ".popsection");
+
+const char *memops_variant(void) {
+    if (cpu_has(CPU_FEATURE_ERMS)) {
+        return "erms";
+    }
+    return cpu_has(CPU_FEATURE_SSE2) ? "sse2" : "integer";
+}
+
+void *memcpy(void *dest, const void *src, size_t size) {
+    if (size < MEMOPS_SMALL) {
+        copy_forward(dest, src, size);
+        return dest;
+    }
+    return memops_copy(dest, src, size);
+}
+
+void *memset(void *ptr, int value, size_t size) {
+    if (size < MEMOPS_SMALL) {
+        fill_forward(ptr, (uint8_t)value, size);
+        return ptr;
+    }
+    return memops_fill(ptr, value, size);
+}
+
+void *memmove(void *dest, const void *src, size_t size) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    if (d == s || size == 0) {
+        return dest;
+    }
+
+    /* Disjoint regions take the full memcpy fast path */
+    if (d + size <= s || s + size <= d) {
+        return memcpy(dest, src, size);
+    }
+
+    /* Overlapping: word copies in the safe direction. Each block of words is
+     * loaded before it is stored, so this is correct for any distance. */
+    if (d < s) {
+        copy_forward(d, s, size);
+    } else {
+        copy_backward(d + size, s + size, size);
+    }
+    return dest;
+}
+
+/* Self-test
+ *
+ * Boot patches in one variant, so the others would never run. Every
+ * variant the CPU can execute is checked here against byte loops, for
+ * destination alignments 0-15 and sizes on both sides of each threshold,
+ * with guard bytes around the destination. memmove() is checked for
+ * overlap in both directions. rep movsb/stosb work on any CPU, so erms is
+ * always included. */
+
+#define SELFTEST_MAX   (MEMOPS_SSE_MIN * 2 + 64)
+#define SELFTEST_GUARD 16
+#define SELFTEST_FILL  0x5A
+
+typedef struct memops_impl {
+    const char *name;
+    void *(*copy)(void *dest, const void *src, size_t size);
+    void *(*fill)(void *ptr, int value, size_t size);
+    int sse2;
+} memops_impl_t;
+
+static const memops_impl_t memops_tests[] = {
+    { "integer", memcpy_integer, memset_integer, 0 },
+    { "sse2", memcpy_sse2, memset_sse2, 1 },
+    { "erms", memcpy_erms, memset_erms, 0 },
+    { "nt", memcpy_nt, memset_nt, 0 },
+};
+
+static const size_t memops_test_sizes[] = {
+    0, 1, 3, 4, 15, 16, 17,
+    MEMOPS_SMALL - 1, MEMOPS_SMALL, MEMOPS_SMALL + 1,
+    MEMOPS_NT_MIN - 1, MEMOPS_NT_MIN, MEMOPS_NT_MIN + 1,
+    MEMOPS_SSE_MIN - 1, MEMOPS_SSE_MIN, MEMOPS_SSE_MIN + 1,
+    MEMOPS_SSE_MIN * 2 + 13,
+};
+
+static uint8_t selftest_src[SELFTEST_MAX + 16];
+static uint8_t selftest_dst[SELFTEST_MAX + 16 + 2 * SELFTEST_GUARD] __attribute__((aligned(16)));
+
+static uint8_t selftest_byte(size_t i) {
+    return (uint8_t)(i * 7 + 3);
+}
+
+/* Guard bytes outside [d, d + size) must still hold SELFTEST_FILL */
+static int selftest_guards_ok(const uint8_t *d, size_t size) {
+    for (size_t i = 1; i <= SELFTEST_GUARD; i++) {
+        if (d[-(ptrdiff_t)i] != SELFTEST_FILL || d[size + i - 1] != SELFTEST_FILL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint32_t selftest_variant(const memops_impl_t *t) {
+    uint32_t errors = 0;
+
+    for (size_t i = 0; i < sizeof(selftest_src); i++) {
+        selftest_src[i] = selftest_byte(i);
+    }
+
+    for (size_t n = 0; n < sizeof(memops_test_sizes) / sizeof(memops_test_sizes[0]); n++) {
+        size_t size = memops_test_sizes[n];
+        for (size_t align = 0; align < 16; align++) {
+            uint8_t *d = selftest_dst + SELFTEST_GUARD + align;
+            const uint8_t *s = selftest_src + ((align * 7) & 15);
+
+            for (size_t i = 0; i < sizeof(selftest_dst); i++) {
+                selftest_dst[i] = SELFTEST_FILL;
+            }
+            t->copy(d, s, size);
+            for (size_t i = 0; i < size; i++) {
+                if (d[i] != s[i]) {
+                    errors++;
+                    break;
+                }
+            }
+            errors += !selftest_guards_ok(d, size);
+
+            t->fill(d, 0xC3, size);
+            for (size_t i = 0; i < size; i++) {
+                if (d[i] != 0xC3) {
+                    errors++;
+                    break;
+                }
+            }
+            errors += !selftest_guards_ok(d, size);
+        }
+    }
+    return errors;
+}
+
+/* Overlapping moves both ways, checked against the original pattern */
+static uint32_t selftest_memmove(void) {
+    static const size_t distances[] = { 1, 3, 4, 15, 16, 17, 64 };
+    static const size_t sizes[] = { 1, 15, 64, MEMOPS_NT_MIN + 3, MEMOPS_SSE_MIN + 5 };
+    uint32_t errors = 0;
+
+    for (size_t k = 0; k < sizeof(distances) / sizeof(distances[0]); k++) {
+        for (size_t n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++) {
+            for (int backward = 0; backward < 2; backward++) {
+                size_t dist = distances[k];
+                size_t size = sizes[n];
+                uint8_t *lo = selftest_dst + SELFTEST_GUARD + (dist & 7);
+                uint8_t *d = backward ? lo + dist : lo;
+                const uint8_t *s = backward ? lo : lo + dist;
+                size_t s_off = (size_t)(s - selftest_dst);
+
+                for (size_t i = 0; i < sizeof(selftest_dst); i++) {
+                    selftest_dst[i] = selftest_byte(i);
+                }
+                memmove(d, s, size);
+                for (size_t i = 0; i < size; i++) {
+                    if (d[i] != selftest_byte(s_off + i)) {
+                        errors++;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    return errors;
+}
+
+void memops_selftest(void) {
+    uint32_t errors = 0;
+
+    for (size_t i = 0; i < sizeof(memops_tests) / sizeof(memops_tests[0]); i++) {
+        const memops_impl_t *t = &memops_tests[i];
+        if (t->sse2 && !cpu_has(CPU_FEATURE_SSE2)) {
+            continue;
+        }
+        uint32_t failed = selftest_variant(t);
+        if (failed) {
+            kprintf("Memory ops self-test: %s FAILED (%u cases)\n", t->name, failed);
+        }
+        errors += failed;
+    }
+
+    uint32_t failed = selftest_memmove();
+    if (failed) {
+        kprintf("Memory ops self-test: memmove FAILED (%u cases)\n", failed);
+    }
+    errors += failed;
+
+    kprintf("Memory ops self-test (%s): %s\n", memops_variant(), errors ? "FAILED" : "PASSED");
+}
@@ -0,0 +1,432 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "kernel.h"
+#include "memory.h"
+#include "cpu.h"
+#include "fpu.h"
+
+/*
+ * String and compare routines
+ *
+ * Scans work a 32-bit word at a time using the classic has-zero-byte test:
+ *
+ *   HAS_ZERO(x) = (x - 0x01010101) & ~x & 0x80808080
+ *
+ * which is non-zero iff some byte of x is zero. Searching for a byte c is the
+ * same test on x ^ (c * 0x01010101).
+ *
+ * Page safety: a scan for a terminator may not know where the string ends,
+ * so it only ever loads naturally aligned words (or aligned 16-byte blocks
+ * in the SSE2 paths). An aligned load never crosses a page boundary, so if
+ * the first byte is mapped, the whole load is. Bytes loaded before the start
+ * of the string are masked off. Bounded routines (memchr, memcmp) never read
+ * outside [ptr, ptr + n) at all.
+ *
+ * SSE2 versions of strlen, memchr and memcmp take over for long inputs, when
+ * the CPU has SSE2 and kernel_fpu_usable() allows it.
+ */
+
+#define ONES  0x01010101u
+#define HIGHS 0x80808080u
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
+#define STRING_SSE_MIN 256
+
+typedef uint32_t __attribute__((may_alias, aligned(1))) word_t;
+typedef uint32_t __attribute__((may_alias)) aligned_word_t;
+
+static inline int string_sse2_usable(void) {
+    return cpu_has(CPU_FEATURE_SSE2) && kernel_fpu_usable();
+}
+
+/* SSE2 kernels: bodies are pure asm, called between kernel_fpu_begin/end */
+
+/* Index of the first zero byte at or after the 16-byte aligned `p` */
+__attribute__((target("sse2"), noinline))
+static size_t sse2_find_zero(const char *p) {
+    const char *start = p;
+    uint32_t mask;
+
+    __asm__ volatile ("pxor %%xmm1, %%xmm1\n"
+                      "1:\n\t"
+                      "movdqa (%0), %%xmm0\n\t"
+                      "pcmpeqb %%xmm1, %%xmm0\n\t"
+                      "pmovmskb %%xmm0, %1\n\t"
+                      "addl $16, %0\n\t"
+                      "testl %1, %1\n\t"
+                      "jz 1b\n\t"
+                      "subl $16, %0"
+                      : "+r"(p), "=&r"(mask)
+                      : : "memory", "cc", "xmm0", "xmm1");
+
+    return (size_t)(p - start) + __builtin_ctz(mask);
+}
+
+/* First byte equal to the splatted `c32` in `blocks` aligned 16-byte blocks */
+__attribute__((target("sse2"), noinline))
+static const uint8_t *sse2_find_byte(const uint8_t *p, size_t blocks, uint32_t c32) {
+    uint32_t mask = 0;
+
+    __asm__ volatile ("movd %3, %%xmm1\n\t"
+                      "pshufd $0, %%xmm1, %%xmm1\n"
+                      "1:\n\t"
+                      "movdqa (%0), %%xmm0\n\t"
+                      "pcmpeqb %%xmm1, %%xmm0\n\t"
+                      "pmovmskb %%xmm0, %2\n\t"
+                      "testl %2, %2\n\t"
+                      "jnz 2f\n\t"
+                      "addl $16, %0\n\t"
+                      "decl %1\n\t"
+                      "jnz 1b\n"
+                      "2:"
+                      : "+r"(p), "+r"(blocks), "+r"(mask)
+                      : "r"(c32)
+                      : "memory", "cc", "xmm0", "xmm1");
+
+    return mask ? p + __builtin_ctz(mask) : NULL;
+}
+
+/* Offset of the first differing byte in `blocks` 16-byte blocks, or -1 */
+__attribute__((target("sse2"), noinline))
+static int32_t sse2_find_mismatch(const uint8_t *a, const uint8_t *b, size_t blocks) {
+    const uint8_t *start = a;
+    uint32_t mask = 0xFFFF;
+
+    __asm__ volatile ("1:\n\t"
+                      "movdqu (%0), %%xmm0\n\t"
+                      "movdqu (%1), %%xmm1\n\t"
+                      "pcmpeqb %%xmm1, %%xmm0\n\t"
+                      "pmovmskb %%xmm0, %3\n\t"
+                      "cmpl $0xFFFF, %3\n\t"
+                      "jne 2f\n\t"
+                      "addl $16, %0\n\t"
+                      "addl $16, %1\n\t"
+                      "decl %2\n\t"
+                      "jnz 1b\n"
+                      "2:"
+                      : "+r"(a), "+r"(b), "+r"(blocks), "+r"(mask)
+                      : : "memory", "cc", "xmm0", "xmm1");
+
+    if (mask == 0xFFFF) {
+        return -1;
+    }
+    return (int32_t)(a - start) + __builtin_ctz(~mask & 0xFFFF);
+}
+
+/* Length */
+
+size_t strlen(const char *str) {
+    uintptr_t misalign = (uintptr_t)str & 3;
+    const aligned_word_t *w = (const aligned_word_t *)((uintptr_t)str - misalign);
+
+    /* Force the bytes in front of the string to be non-zero */
+    uint32_t v = *w | ((1u << (misalign * 8)) - 1);
+
+    size_t scanned = 0;
+    while (!HAS_ZERO(v)) {
+        v = *++w;
+        scanned += 4;
+
+        if (scanned == STRING_SSE_MIN && string_sse2_usable()) {
+            /* Long string: finish 16 bytes per step from the next aligned block */
+            const char *p = (const char *)w;
+            while ((uintptr_t)p & 15) {
+                if (!*p) {
+                    return (size_t)(p - str);
+                }
+                p++;
+            }
+            kernel_fpu_begin();
+            size_t len = (size_t)(p - str) + sse2_find_zero(p);
+            kernel_fpu_end();
+            return len;
+        }
+    }
+
+    const char *p = (const char *)w;
+    if (p < str) {
+        p = str;
+    }
+    while (*p) {
+        p++;
+    }
+    return (size_t)(p - str);
+}
+
+size_t strnlen(const char *str, size_t max) {
+    const char *end = memchr(str, 0, max);
+    return end ? (size_t)(end - str) : max;
+}
+
+/* Search */
+
+void *memchr(const void *ptr, int value, size_t size) {
+    const uint8_t *p = ptr;
+    uint8_t c = (uint8_t)value;
+
+    while (size && ((uintptr_t)p & 3)) {
+        if (*p == c) {
+            return (void *)p;
+        }
+        p++;
+        size--;
+    }
+
+    if (size >= STRING_SSE_MIN && string_sse2_usable()) {
+        while ((uintptr_t)p & 15) {
+            if (*p == c) {
+                return (void *)p;
+            }
+            p++;
+            size--;
+        }
+        kernel_fpu_begin();
+        const uint8_t *hit = sse2_find_byte(p, size / 16, c * ONES);
+        kernel_fpu_end();
+        if (hit) {
+            return (void *)hit;
+        }
+        p += size & ~15;
+        size &= 15;
+    }
+
+    uint32_t pattern = c * ONES;
+    while (size >= 4) {
+        uint32_t v = *(const aligned_word_t *)p ^ pattern;
+        if (HAS_ZERO(v)) {
+            break;
+        }
+        p += 4;
+        size -= 4;
+    }
+
+    while (size--) {
+        if (*p == c) {
+            return (void *)p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+char *strchr(const char *str, int value) {
+    char c = (char)value;
+    uintptr_t misalign = (uintptr_t)str & 3;
+    const aligned_word_t *w = (const aligned_word_t *)((uintptr_t)str - misalign);
+    uint32_t pattern = (uint8_t)c * ONES;
+
+    /* Bytes in front of the string are replaced with a value that is
+     * neither zero nor c */
+    uint32_t filler = (uint8_t)(c + 1) | 0x01;
+    uint32_t front = misalign ? (1u << (misalign * 8)) - 1 : 0;
+    uint32_t v = (*w & ~front) | ((filler * ONES) & front);
+
+    while (!HAS_ZERO(v) && !HAS_ZERO(v ^ pattern)) {
+        v = *++w;
+    }
+
+    const char *p = (const char *)w;
+    if (p < str) {
+        p = str;
+    }
+    for (;; p++) {
+        if (*p == c) {
+            return (char *)p;
+        }
+        if (!*p) {
+            return NULL;
+        }
+    }
+}
+
+/* Compare */
+
+int memcmp(const void *ptr1, const void *ptr2, size_t size) {
+    const uint8_t *a = ptr1;
+    const uint8_t *b = ptr2;
+
+    if (size >= STRING_SSE_MIN && string_sse2_usable()) {
+        kernel_fpu_begin();
+        int32_t offset = sse2_find_mismatch(a, b, size / 16);
+        kernel_fpu_end();
+        if (offset >= 0) {
+            return a[offset] - b[offset];
+        }
+        a += size & ~15;
+        b += size & ~15;
+        size &= 15;
+    }
+
+    while (size >= 4) {
+        uint32_t x = *(const word_t *)a;
+        uint32_t y = *(const word_t *)b;
+        if (x != y) {
+            /* Byte-swap so the first differing byte is the most significant */
+            return __builtin_bswap32(x) < __builtin_bswap32(y) ? -1 : 1;
+        }
+        a += 4;
+        b += 4;
+        size -= 4;
+    }
+
+    while (size--) {
+        if (*a != *b) {
+            return *a - *b;
+        }
+        a++;
+        b++;
+    }
+    return 0;
+}
+
+int strncmp(const char *str1, const char *str2, size_t size) {
+    const uint8_t *a = (const uint8_t *)str1;
+    const uint8_t *b = (const uint8_t *)str2;
+
+    /* Words only when both strings can be aligned together */
+    if ((((uintptr_t)a ^ (uintptr_t)b) & 3) == 0) {
+        while (size && ((uintptr_t)a & 3)) {
+            if (*a != *b || !*a) {
+                return *a - *b;
+            }
+            a++;
+            b++;
+            size--;
+        }
+
+        while (size >= 4) {
+            uint32_t x = *(const aligned_word_t *)a;
+            uint32_t y = *(const aligned_word_t *)b;
+            if (x != y || HAS_ZERO(x)) {
+                break;
+            }
+            a += 4;
+            b += 4;
+            size -= 4;
+        }
+    }
+
+    while (size--) {
+        if (*a != *b || !*a) {
+            return *a - *b;
+        }
+        a++;
+        b++;
+    }
+    return 0;
+}
+
+int strcmp(const char *str1, const char *str2) {
+    return strncmp(str1, str2, SIZE_MAX);
+}
+
+/* Self-test
+ *
+ * Nothing at boot is long enough to reach the SSE2 loops, so they are
+ * checked here against byte loops, on both sides of STRING_SSE_MIN and
+ * from every start alignment within a block. The hard cases are a match
+ * or NUL in the very last byte, and a mismatch in the first or the last
+ * 16-byte block. Strings also end on the last byte of a page. With paging
+ * on, the next page could be unmapped, and only aligned loads keep the
+ * scan from touching it. */
+
+#define STRING_TEST_PAGE 4096
+
+static uint8_t string_test_page[STRING_TEST_PAGE] __attribute__((aligned(STRING_TEST_PAGE)));
+
+static const size_t string_test_sizes[] = {
+    1, 3, 4, 15, 16, 17, 63,
+    STRING_SSE_MIN - 1, STRING_SSE_MIN, STRING_SSE_MIN + 1,
+    STRING_SSE_MIN + 15, STRING_SSE_MIN + 16, STRING_SSE_MIN * 3 + 7,
+};
+
+static size_t byte_strlen(const char *str) {
+    size_t len = 0;
+    while (str[len]) {
+        len++;
+    }
+    return len;
+}
+
+static int sign(int value) {
+    return (value > 0) - (value < 0);
+}
+
+static uint32_t string_test_strlen(size_t size, size_t align) {
+    uint32_t errors = 0;
+    char *str = (char *)string_test_page + align;
+
+    /* NUL in the last byte, then ending right at the page boundary */
+    for (size_t i = 0; i < STRING_TEST_PAGE; i++) {
+        string_test_page[i] = 'a' + (i & 15);
+    }
+    str[size - 1] = '\0';
+    errors += strlen(str) != size - 1 || byte_strlen(str) != size - 1;
+
+    string_test_page[STRING_TEST_PAGE - 1] = '\0';
+    str = (char *)string_test_page + STRING_TEST_PAGE - size;
+    errors += strlen(str) != size - 1;
+    return errors;
+}
+
+static uint32_t string_test_memchr(size_t size, size_t align) {
+    uint32_t errors = 0;
+    uint8_t *p = string_test_page + align;
+
+    for (size_t i = 0; i < STRING_TEST_PAGE; i++) {
+        string_test_page[i] = 0x11;
+    }
+    errors += memchr(p, 0x22, size) != NULL;
+
+    /* Just past the end does not count; the last byte does */
+    p[size] = 0x22;
+    errors += memchr(p, 0x22, size) != NULL;
+    p[size - 1] = 0x22;
+    errors += memchr(p, 0x22, size) != p + size - 1;
+
+    /* At the page boundary */
+    p = string_test_page + STRING_TEST_PAGE - size;
+    string_test_page[STRING_TEST_PAGE - 1] = 0x33;
+    errors += memchr(p, 0x33, size) != p + size - 1;
+    return errors;
+}
+
+static uint32_t string_test_memcmp(size_t size, size_t align) {
+    uint32_t errors = 0;
+    uint8_t *a = string_test_page + align;
+    uint8_t *b = string_test_page + STRING_TEST_PAGE / 2 + ((align * 5) & 15);
+    size_t first = size < 16 ? size : 16;
+    size_t spots[] = { 0, first - 1, size - first, size - 1 };
+
+    for (size_t i = 0; i < size; i++) {
+        a[i] = b[i] = (uint8_t)(i * 13);
+    }
+    errors += memcmp(a, b, size) != 0;
+
+    for (size_t k = 0; k < sizeof(spots) / sizeof(spots[0]); k++) {
+        size_t at = spots[k];
+        uint8_t saved = b[at];
+
+        b[at] = (uint8_t)(saved + 1);
+        errors += sign(memcmp(a, b, size)) != sign(a[at] - b[at]);
+        errors += sign(memcmp(b, a, size)) != sign(b[at] - a[at]);
+        b[at] = saved;
+    }
+    return errors;
+}
+
+void string_selftest(void) {
+    uint32_t errors = 0;
+
+    for (size_t n = 0; n < sizeof(string_test_sizes) / sizeof(string_test_sizes[0]); n++) {
+        for (size_t align = 0; align < 16; align++) {
+            size_t size = string_test_sizes[n];
+            errors += string_test_strlen(size, align);
+            errors += string_test_memchr(size, align);
+            errors += string_test_memcmp(size, align);
+        }
+    }
+
+    kprintf("String self-test (%s): %s\n", string_sse2_usable() ? "sse2" : "word",
+            errors ? "FAILED" : "PASSED");
+}
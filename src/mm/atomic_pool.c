@@ -0,0 +1,180 @@
+#include "memory.h"
+#include "kernel.h"
+
+/*
+ * Interrupt-safe atomic allocation pool
+ *
+ * Each size class is a Treiber stack of ordinary heap blocks tagged with
+ * HEAP_BLOCK_ATOMIC. The stack head is a {pointer, generation} pair updated
+ * with cmpxchg8b, so a pop interrupted by a pop/push pair on the same object
+ * cannot succeed with a stale next pointer (ABA). Neither path disables
+ * interrupts or touches the heap lists, so IRQ handlers can allocate and
+ * free at any time. kfree() recognises pool objects by their header flag and
+ * returns them here.
+ */
+
+typedef union atomic_pool_head {
+    uint64_t raw;
+    struct {
+        void *top;
+        uint32_t generation;
+    };
+} atomic_pool_head_t;
+
+typedef struct atomic_pool_class {
+    volatile uint64_t head;
+    volatile uint32_t count;
+} atomic_pool_class_t;
+
+static atomic_pool_class_t pool_classes[ATOMIC_POOL_CLASSES];
+static atomic_pool_stats_t pool_stats;
+static volatile int pool_refilling = 0;
+
+static inline size_t pool_class_size(uint32_t cls) {
+    return (size_t)ATOMIC_POOL_MIN_SIZE << cls;
+}
+
+/* Smallest class that fits `size`, or -1 */
+static int pool_class_for_size(size_t size) {
+    for (uint32_t cls = 0; cls < ATOMIC_POOL_CLASSES; cls++) {
+        if (size <= pool_class_size(cls)) {
+            return (int)cls;
+        }
+    }
+    return -1;
+}
+
+/* Largest class a block can serve (blocks may be bigger than their class) */
+static int pool_class_for_block(const heap_block_t *block) {
+    for (int cls = ATOMIC_POOL_CLASSES - 1; cls >= 0; cls--) {
+        if (block->size >= pool_class_size(cls)) {
+            return cls;
+        }
+    }
+    return -1;
+}
+
+static void pool_push(atomic_pool_class_t *pc, void *obj) {
+    atomic_pool_head_t old, new;
+
+    do {
+        old.raw = pc->head;
+        *(void **)obj = old.top;
+        new.top = obj;
+        new.generation = old.generation + 1;
+    } while (!__sync_bool_compare_and_swap(&pc->head, old.raw, new.raw));
+
+    __sync_fetch_and_add(&pc->count, 1);
+}
+
+static void *pool_pop(atomic_pool_class_t *pc) {
+    atomic_pool_head_t old, new;
+
+    do {
+        old.raw = pc->head;
+        if (!old.top) {
+            return NULL;
+        }
+        /* May read a block another context just popped; the generation
+         * check makes the CAS fail in that case */
+        new.top = *(void **)old.top;
+        new.generation = old.generation + 1;
+    } while (!__sync_bool_compare_and_swap(&pc->head, old.raw, new.raw));
+
+    __sync_fetch_and_sub(&pc->count, 1);
+    return old.top;
+}
+
+void atomic_pool_init(void) {
+    memset(pool_classes, 0, sizeof(pool_classes));
+    memset(&pool_stats, 0, sizeof(pool_stats));
+    atomic_pool_refill();
+}
+
+void *atomic_pool_alloc(size_t size) {
+    int cls = pool_class_for_size(size);
+    if (cls < 0) {
+        __sync_fetch_and_add(&pool_stats.failures, 1);
+        return NULL;
+    }
+
+    /* Fall back to larger classes before failing */
+    for (; cls < ATOMIC_POOL_CLASSES; cls++) {
+        atomic_pool_class_t *pc = &pool_classes[cls];
+        void *obj = pool_pop(pc);
+        if (obj) {
+            __sync_fetch_and_add(&pool_stats.allocs, 1);
+            if (pc->count < ATOMIC_POOL_LOW) {
+                __sync_fetch_and_add(&pool_stats.low_events, 1);
+            }
+            return obj;
+        }
+    }
+
+    __sync_fetch_and_add(&pool_stats.failures, 1);
+    return NULL;
+}
+
+void atomic_pool_free(heap_block_t *block) {
+    int cls = pool_class_for_block(block);
+    if (cls < 0) {
+        return; /* Not a pool block; cannot happen for HEAP_BLOCK_ATOMIC */
+    }
+
+    pool_push(&pool_classes[cls], (uint8_t *)block + sizeof(heap_block_t));
+    __sync_fetch_and_add(&pool_stats.frees, 1);
+}
+
+/* Process context only: tops every class up to ATOMIC_POOL_TARGET and gives
+ * surplus objects (freed into the pool after a burst) back to the heap */
+void atomic_pool_refill(void) {
+    if (__sync_lock_test_and_set(&pool_refilling, 1)) {
+        return;
+    }
+
+    for (uint32_t cls = 0; cls < ATOMIC_POOL_CLASSES; cls++) {
+        atomic_pool_class_t *pc = &pool_classes[cls];
+
+        while (pc->count < ATOMIC_POOL_TARGET) {
+            void *obj = kmalloc_gfp(pool_class_size(cls), GFP_KERNEL | GFP_NOFENCE);
+            if (!obj) {
+                break;
+            }
+            heap_block_t *block = (heap_block_t *)((uint8_t *)obj - sizeof(heap_block_t));
+            block->flags |= HEAP_BLOCK_ATOMIC;
+            pool_push(pc, obj);
+            pool_stats.refills++;
+        }
+
+        while (pc->count > ATOMIC_POOL_TARGET * 2) {
+            void *obj = pool_pop(pc);
+            if (!obj) {
+                break;
+            }
+            heap_block_t *block = (heap_block_t *)((uint8_t *)obj - sizeof(heap_block_t));
+            block->flags &= ~HEAP_BLOCK_ATOMIC;
+            kfree(obj);
+        }
+    }
+
+    __sync_lock_release(&pool_refilling);
+}
+
+void atomic_pool_get_stats(atomic_pool_stats_t *stats) {
+    *stats = pool_stats;
+    for (uint32_t cls = 0; cls < ATOMIC_POOL_CLASSES; cls++) {
+        stats->available[cls] = pool_classes[cls].count;
+    }
+}
+
+void atomic_pool_print_stats(void) {
+    atomic_pool_stats_t stats;
+    atomic_pool_get_stats(&stats);
+
+    kprintf("Atomic pool: %u allocs, %u frees, %u low, %u failed\n  available:",
+            stats.allocs, stats.frees, stats.low_events, stats.failures);
+    for (uint32_t cls = 0; cls < ATOMIC_POOL_CLASSES; cls++) {
+        kprintf(" %uB=%u", (uint32_t)pool_class_size(cls), stats.available[cls]);
+    }
+    kprintf("\n");
+}
@@ -0,0 +1,143 @@
+#include "memory.h"
+#include "kernel.h"
+
+/*
+ * Sampling heap profiler
+ *
+ * kmalloc() subtracts every allocation from heap_profile_countdown. When the
+ * counter crosses zero the allocation is sampled: the caller's stack is walked
+ * through the frame-pointer chain, hashed, and charged to a slot in a fixed
+ * call-site table. Each sample stands for `rate` bytes (or the whole block if
+ * it is larger), so per-site totals are unbiased estimates of real usage.
+ *
+ * The fast path is one subtract and one branch per allocation, cheap enough
+ * to leave enabled in production builds.
+ */
+
+int32_t heap_profile_countdown = INT32_MAX;
+
+static heap_profile_site_t profile_sites[HEAP_PROFILE_SITES];
+static uint32_t profile_rate = 0;
+static uint32_t profile_rng = 0x2545F491;
+static uint32_t profile_dropped = 0;
+
+/* xorshift32 - only used to jitter the sampling interval */
+static uint32_t profile_random(void) {
+    uint32_t x = profile_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    profile_rng = x;
+    return x;
+}
+
+/* Pick the next interval uniformly in [rate/2, 3*rate/2) so periodic
+ * allocation patterns cannot alias with the sampler */
+static void profile_rearm(void) {
+    if (!profile_rate) {
+        heap_profile_countdown = INT32_MAX;
+        return;
+    }
+    heap_profile_countdown = (int32_t)(profile_rate / 2 + profile_random() % profile_rate);
+}
+
+static uint32_t profile_hash_stack(const uint32_t *stack, uint32_t depth) {
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    for (uint32_t i = 0; i < depth; i++) {
+        hash ^= stack[i];
+        hash *= 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+static size_t profile_weight(size_t size) {
+    return size >= profile_rate ? size : profile_rate;
+}
+
+void heap_profile_init(void) {
+    heap_profile_reset();
+    heap_profile_set_rate(HEAP_PROFILE_DEFAULT_RATE);
+}
+
+void heap_profile_set_rate(uint32_t rate) {
+    profile_rate = rate;
+    profile_rearm();
+}
+
+void heap_profile_reset(void) {
+    memset(profile_sites, 0, sizeof(profile_sites));
+    profile_dropped = 0;
+}
+
+/* Slow path, called from kmalloc() once the countdown expires */
+__attribute__((noinline))
+void heap_profile_sample(heap_block_t *block, size_t size) {
+    uint32_t stack[HEAP_PROFILE_DEPTH];
+
+    profile_rearm();
+    if (!profile_rate) {
+        return;
+    }
+
+    /* Start at kmalloc()'s frame so the first entry is its caller */
+    uint32_t *fp = *(uint32_t **)__builtin_frame_address(0);
+    uint32_t depth = stack_capture(fp, stack, HEAP_PROFILE_DEPTH);
+    uint32_t hash = profile_hash_stack(stack, depth);
+
+    /* Open addressing with linear probing */
+    uint32_t slot = hash & (HEAP_PROFILE_SITES - 1);
+    for (uint32_t probe = 0; probe < HEAP_PROFILE_SITES; probe++) {
+        heap_profile_site_t *site = &profile_sites[slot];
+
+        if (site->hash == 0) {
+            site->hash = hash;
+            site->depth = depth;
+            memcpy(site->stack, stack, depth * sizeof(uint32_t));
+        }
+
+        if (site->hash == hash) {
+            size_t weight = profile_weight(size);
+            site->live_bytes += weight;
+            site->total_bytes += weight;
+            site->samples++;
+
+            block->flags |= HEAP_BLOCK_SAMPLED;
+            block->prof_site = (uint16_t)slot;
+            return;
+        }
+
+        slot = (slot + 1) & (HEAP_PROFILE_SITES - 1);
+    }
+
+    profile_dropped++;
+}
+
+void heap_profile_release(heap_block_t *block) {
+    heap_profile_site_t *site = &profile_sites[block->prof_site];
+    size_t weight = profile_weight(block->size);
+
+    site->live_bytes = site->live_bytes > weight ? site->live_bytes - weight : 0;
+    block->flags &= ~HEAP_BLOCK_SAMPLED;
+}
+
+void heap_profile_dump(void) {
+    kprintf("Heap profile (rate %u bytes):\n", profile_rate);
+
+    for (uint32_t i = 0; i < HEAP_PROFILE_SITES; i++) {
+        heap_profile_site_t *site = &profile_sites[i];
+        if (!site->hash) {
+            continue;
+        }
+
+        kprintf("  live %k total %k samples %u\n   ",
+                site->live_bytes, site->total_bytes, site->samples);
+        for (uint32_t d = 0; d < site->depth; d++) {
+            kprintf(" %p", (void *)site->stack[d]);
+        }
+        kprintf("\n");
+    }
+
+    if (profile_dropped) {
+        kprintf("  dropped samples: %u\n", profile_dropped);
+    }
+}
@@ -0,0 +1,246 @@
+#include "memory.h"
+#include "kernel.h"
+#include "cpu.h"
+#include "log.h"
+
+/*
+ * Sampled guard-page allocator (KFENCE-style)
+ *
+ * Every KFENCE_SAMPLE_INTERVAL-th kmalloc() is served from a small pool where
+ * each object owns a whole page and every object page is flanked by guard
+ * pages that are never mapped:
+ *
+ *   KFENCE_VIRTUAL_START: [guard][obj 0][guard][obj 1][guard] ... [guard]
+ *
+ * Objects alternate between the start and the end of their page so both
+ * underflows and overflows run into a guard page. The slack around the object
+ * is filled with a canary that kfree() checks, catching small overflows that
+ * stay inside the page. Freed object pages are unmapped and recycled in FIFO
+ * order, so use-after-free faults for as long as possible.
+ *
+ * Physical frames are allocated once in kfence_init() and stay owned by the
+ * pool; only the present bit changes afterwards.
+ */
+
+#define KFENCE_CANARY(addr) ((uint8_t)(0xAA ^ ((addr) & 0x7)))
+
+enum kfence_state {
+    KFENCE_UNUSED = 0,
+    KFENCE_ALLOCATED,
+    KFENCE_FREED
+};
+
+typedef struct kfence_object {
+    uint32_t addr;          /* Object start, 0 if never allocated */
+    size_t size;            /* Requested size */
+    uint32_t state;
+    uint32_t alloc_depth;
+    uint32_t free_depth;
+    uint32_t alloc_stack[KFENCE_STACK_DEPTH];
+    uint32_t free_stack[KFENCE_STACK_DEPTH];
+} kfence_object_t;
+
+int32_t kfence_countdown = INT32_MAX;
+
+static kfence_object_t kfence_objects[KFENCE_NUM_OBJECTS];
+static int kfence_enabled = 0;
+
+/* FIFO of free object slots */
+static uint16_t kfence_fifo[KFENCE_NUM_OBJECTS];
+static uint32_t kfence_fifo_head = 0;
+static uint32_t kfence_fifo_count = 0;
+
+/* Statistics */
+static uint32_t kfence_allocs = 0;
+static uint32_t kfence_frees = 0;
+static uint32_t kfence_bugs = 0;
+
+static inline uint32_t kfence_object_page(uint32_t index) {
+    return KFENCE_VIRTUAL_START + (index * 2 + 1) * PAGE_SIZE;
+}
+
+static void kfence_fifo_push(uint32_t index) {
+    kfence_fifo[(kfence_fifo_head + kfence_fifo_count) % KFENCE_NUM_OBJECTS] = (uint16_t)index;
+    kfence_fifo_count++;
+}
+
+static int kfence_fifo_pop(void) {
+    if (!kfence_fifo_count) {
+        return -1;
+    }
+    int index = kfence_fifo[kfence_fifo_head];
+    kfence_fifo_head = (kfence_fifo_head + 1) % KFENCE_NUM_OBJECTS;
+    kfence_fifo_count--;
+    return index;
+}
+
+void kfence_init(void) {
+    if (!(read_cr0() & CR0_PG)) {
+        log_notice("KFENCE: paging disabled, sampling off");
+        return;
+    }
+
+    for (uint32_t i = 0; i < KFENCE_NUM_OBJECTS; i++) {
+        uint32_t frame = pmm_alloc_page();
+        if (!frame) {
+            break;
+        }
+        /* Mapped but not present until the slot is handed out */
+        vmm_map_page(kfence_object_page(i), frame, 0);
+        kfence_fifo_push(i);
+    }
+
+    if (!kfence_fifo_count) {
+        log_warn("KFENCE: no memory for pool, sampling off");
+        return;
+    }
+
+    kfence_enabled = 1;
+    kfence_countdown = KFENCE_SAMPLE_INTERVAL;
+    log_info("KFENCE: guard-page sampling enabled");
+}
+
+/* Called from kmalloc() once the countdown expires; NULL falls back to the heap */
+__attribute__((noinline))
+void *kfence_alloc(size_t size) {
+    if (!kfence_enabled) {
+        kfence_countdown = INT32_MAX;
+        return NULL;
+    }
+    kfence_countdown = KFENCE_SAMPLE_INTERVAL;
+
+    if (size == 0 || size > PAGE_SIZE) {
+        return NULL;
+    }
+
+    int index = kfence_fifo_pop();
+    if (index < 0) {
+        return NULL;
+    }
+
+    kfence_object_t *obj = &kfence_objects[index];
+    uint32_t page = kfence_object_page(index);
+    size_t aligned = (size + 7) & ~7;
+
+    vmm_protect_page(page, PAGE_PRESENT | PAGE_WRITABLE);
+    for (uint32_t addr = page; addr < page + PAGE_SIZE; addr++) {
+        *(uint8_t *)addr = KFENCE_CANARY(addr);
+    }
+
+    /* Alternate sides so both overflows and underflows hit a guard page */
+    if (kfence_allocs & 1) {
+        obj->addr = page;
+    } else {
+        obj->addr = page + PAGE_SIZE - aligned;
+    }
+    obj->size = size;
+    obj->state = KFENCE_ALLOCATED;
+    obj->free_depth = 0;
+    obj->alloc_depth = stack_capture(*(uint32_t **)__builtin_frame_address(0),
+                                     obj->alloc_stack, KFENCE_STACK_DEPTH);
+
+    kfence_allocs++;
+    return (void *)obj->addr;
+}
+
+static kfence_object_t *kfence_object_at(uint32_t addr) {
+    uint32_t page_index = (addr - KFENCE_VIRTUAL_START) / PAGE_SIZE;
+    if (!(page_index & 1)) {
+        return NULL; /* Guard page */
+    }
+    return &kfence_objects[page_index / 2];
+}
+
+static void kfence_report(const char *what, uint32_t addr, kfence_object_t *obj) {
+    kfence_bugs++;
+
+    kprintf("KFENCE: %s at %p\n", what, (void *)addr);
+
+    if (!obj || !obj->addr) {
+        return;
+    }
+
+    kprintf("  object %p size %zu, allocated by:\n", (void *)obj->addr, obj->size);
+    stack_print(obj->alloc_stack, obj->alloc_depth);
+    if (obj->free_depth) {
+        terminal_writestring("  freed by:\n");
+        stack_print(obj->free_stack, obj->free_depth);
+    }
+}
+
+__attribute__((noinline))
+void kfence_free(void *ptr) {
+    uint32_t addr = (uint32_t)ptr;
+    kfence_object_t *obj = kfence_object_at(addr);
+
+    if (!obj || obj->state != KFENCE_ALLOCATED || obj->addr != addr) {
+        kfence_report("invalid or double free", addr, obj);
+        return;
+    }
+
+    /* Check the canary on both sides of the object */
+    uint32_t page = PAGE_ALIGN_DOWN(addr);
+    for (uint32_t p = page; p < page + PAGE_SIZE; p++) {
+        if (p == obj->addr) {
+            p += obj->size - 1;
+            continue;
+        }
+        if (*(uint8_t *)p != KFENCE_CANARY(p)) {
+            kfence_report("memory corruption", p, obj);
+            break;
+        }
+    }
+
+    obj->free_depth = stack_capture(*(uint32_t **)__builtin_frame_address(0),
+                                    obj->free_stack, KFENCE_STACK_DEPTH);
+    obj->state = KFENCE_FREED;
+    vmm_protect_page(page, 0);
+    kfence_fifo_push(obj - kfence_objects);
+    kfence_frees++;
+}
+
+size_t kfence_ksize(const void *ptr) {
+    kfence_object_t *obj = kfence_object_at((uint32_t)ptr);
+    return obj && obj->state == KFENCE_ALLOCATED ? obj->size : 0;
+}
+
+/* Called by the page fault handler; does not return for pool addresses */
+int kfence_handle_fault(uint32_t addr, int write) {
+    if (!kfence_is_address((void *)addr)) {
+        return 0;
+    }
+
+    const char *what;
+    kfence_object_t *obj = kfence_object_at(addr);
+
+    if (obj) {
+        what = obj->state == KFENCE_FREED ? "use-after-free" : "invalid access";
+    } else {
+        /* Guard page: blame the nearest live neighbour */
+        uint32_t page_index = (addr - KFENCE_VIRTUAL_START) / PAGE_SIZE;
+        kfence_object_t *left = page_index > 0 ? &kfence_objects[page_index / 2 - 1] : NULL;
+        kfence_object_t *right = page_index / 2 < KFENCE_NUM_OBJECTS ?
+                                 &kfence_objects[page_index / 2] : NULL;
+
+        if (left && left->state != KFENCE_ALLOCATED) left = NULL;
+        if (right && right->state != KFENCE_ALLOCATED) right = NULL;
+
+        if (left && right) {
+            uint32_t left_dist = addr - (left->addr + left->size);
+            uint32_t right_dist = right->addr - addr;
+            obj = left_dist <= right_dist ? left : right;
+        } else {
+            obj = left ? left : right;
+        }
+        what = "out-of-bounds access";
+    }
+
+    kfence_report(what, addr, obj);
+    terminal_writestring(write ? "  (write)\n" : "  (read)\n");
+    panic("KFENCE: memory safety violation");
+}
+
+void kfence_print_stats(void) {
+    kprintf("KFENCE: %u allocs, %u frees, %u bugs\n",
+            kfence_allocs, kfence_frees, kfence_bugs);
+}
@@ -0,0 +1,184 @@
+/*
+ * mkinitrd - pack a directory into a Sarrus OS initrd image
+ *
+ * Usage: mkinitrd <output> <directory>
+ *
+ * Every regular file under directory is stored under its path relative
+ * to it, for example "wads/doom1.wad". The layout is in include/initrd.h.
+ * Files start on page boundaries so the kernel can map them straight from
+ * the boot module. Entries are sorted, so the same tree always gives the
+ * same image.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "initrd.h"
+
+typedef struct file {
+    char name[INITRD_NAME_MAX];
+    char path[4096];
+    uint32_t size;
+} file_t;
+
+static file_t *files;
+static size_t file_count;
+static size_t file_capacity;
+
+static void die(const char *what, const char *detail) {
+    fprintf(stderr, "mkinitrd: %s: %s\n", what, detail);
+    exit(1);
+}
+
+static void add_file(const char *name, const char *path, off_t size) {
+    if (strlen(name) >= INITRD_NAME_MAX) {
+        die(name, "name too long");
+    }
+    if (size > (off_t)UINT32_MAX) {
+        die(name, "file too large");
+    }
+    if (file_count == file_capacity) {
+        file_capacity = file_capacity ? file_capacity * 2 : 64;
+        files = realloc(files, file_capacity * sizeof(*files));
+        if (!files) {
+            die("realloc", strerror(errno));
+        }
+    }
+
+    file_t *f = &files[file_count++];
+    memset(f, 0, sizeof(*f));
+    snprintf(f->name, sizeof(f->name), "%s", name);
+    snprintf(f->path, sizeof(f->path), "%s", path);
+    f->size = (uint32_t)size;
+}
+
+/* Collect regular files below dir; prefix is the path inside the image */
+static void scan(const char *dir, const char *prefix) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        die(dir, strerror(errno));
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        char path[4096];
+        char name[4096];
+        struct stat st;
+
+        if (ent->d_name[0] == '.') {
+            continue;       /* ".", ".." and hidden files */
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        snprintf(name, sizeof(name), "%s%s", prefix, ent->d_name);
+        if (stat(path, &st)) {
+            die(path, strerror(errno));
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            strncat(name, "/", sizeof(name) - strlen(name) - 1);
+            scan(path, name);
+        } else if (S_ISREG(st.st_mode)) {
+            add_file(name, path, st.st_size);
+        }
+    }
+    closedir(d);
+}
+
+static int compare_files(const void *a, const void *b) {
+    return strcmp(((const file_t *)a)->name, ((const file_t *)b)->name);
+}
+
+static uint64_t page_align(uint64_t n) {
+    return (n + INITRD_PAGE_SIZE - 1) & ~(uint64_t)(INITRD_PAGE_SIZE - 1);
+}
+
+static void pad_to(FILE *out, uint64_t offset) {
+    static const char zero[INITRD_PAGE_SIZE];
+    long pos = ftell(out);
+    if (pos < 0 || (uint64_t)pos > offset) {
+        die("output", "bad position");
+    }
+    if (fwrite(zero, 1, offset - pos, out) != offset - pos) {
+        die("output", strerror(errno));
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <output> <directory>\n", argv[0]);
+        return 2;
+    }
+
+    scan(argv[2], "");
+    if (file_count) {
+        qsort(files, file_count, sizeof(*files), compare_files);
+    }
+
+    /* Lay out the data after the header and the entry table */
+    initrd_entry_t *entries = calloc(file_count ? file_count : 1, sizeof(*entries));
+    if (!entries) {
+        die("calloc", strerror(errno));
+    }
+    uint64_t offset = page_align(sizeof(initrd_header_t) + file_count * sizeof(initrd_entry_t));
+    for (size_t i = 0; i < file_count; i++) {
+        memcpy(entries[i].name, files[i].name, INITRD_NAME_MAX);
+        entries[i].offset = (uint32_t)offset;
+        entries[i].size = files[i].size;
+        offset = page_align(offset + files[i].size);
+    }
+    if (offset > UINT32_MAX) {
+        die(argv[2], "image larger than 4GB");
+    }
+
+    initrd_header_t header = {
+        .magic = INITRD_MAGIC,
+        .version = INITRD_VERSION,
+        .file_count = (uint32_t)file_count,
+        .total_size = (uint32_t)offset,
+    };
+
+    FILE *out = fopen(argv[1], "wb");
+    if (!out) {
+        die(argv[1], strerror(errno));
+    }
+    if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fwrite(entries, sizeof(*entries), file_count, out) != file_count) {
+        die(argv[1], strerror(errno));
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        FILE *in = fopen(files[i].path, "rb");
+        char buf[65536];
+        size_t n;
+        uint64_t copied = 0;
+
+        if (!in) {
+            die(files[i].path, strerror(errno));
+        }
+        pad_to(out, entries[i].offset);
+        while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+            if (fwrite(buf, 1, n, out) != n) {
+                die(argv[1], strerror(errno));
+            }
+            copied += n;
+        }
+        fclose(in);
+        if (copied != files[i].size) {
+            die(files[i].path, "changed while packing");
+        }
+    }
+    pad_to(out, offset);
+
+    if (fclose(out)) {
+        die(argv[1], strerror(errno));
+    }
+    printf("mkinitrd: %zu files, %llu bytes\n", file_count, (unsigned long long)offset);
+    free(entries);
+    free(files);
+    return 0;
+}